@@ -1,21 +1,12 @@
-QT       += core gui
-
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
-
-CONFIG += c++11
-
-# You can make your code fail to compile if it uses deprecated APIs.
-# In order to do so, uncomment the following line.
-#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
-
-SOURCES += \
-    main.cpp
-
-HEADERS +=
-
-FORMS +=
-
-# Default rules for deployment.
-qnx: target.path = /tmp/$${TARGET}/bin
-else: unix:!android: target.path = /opt/$${TARGET}/bin
-!isEmpty(target.path): INSTALLS += target
+# 顶层工程：程序、策略插件与测试
+# qmake && make && make check
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    app \
+    special_plugin \
+    registry_stress
+
+app.file = context_menu_demo_app.pro
+special_plugin.subdir = plugins/special
+registry_stress.subdir = tests/registry_stress
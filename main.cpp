@@ -12,416 +12,5956 @@
 #include <functional>
 #include <QDebug>
 #include <QList>
-#include <QMessageBox>
+#include <QLocale>
+#include <QTransform>
+#include <algorithm>
+#include <numeric>
 #include <QClipboard>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QPointer>
+#include <QShortcut>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QFileSystemWatcher>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QHash>
+#include <QMimeData>
+#include <QtEndian>
+#include <QPainter>
+#include <cstring>
+#include <QUndoStack>
+#include <limits>
+#include <QSharedData>
+#include <QSharedDataPointer>
+#include <QDir>
+#include <QImage>
+#include <QThread>
+#include <QFileDialog>
+#include <QtMath>
+#include <QtConcurrent>
+#include <QVector>
+#include <QPair>
+#include <QPluginLoader>
+#include <QtPlugin>
+#include <QSet>
+#include <QAbstractListModel>
+#include <QListView>
+#include <QLineEdit>
+#include <QVBoxLayout>
+#include <QWidgetAction>
+#include <QKeyEvent>
+#include <QIcon>
+#include <QPixmap>
+#include <QCache>
+#include <QSvgRenderer>
+#include <QLabel>
+#include <QColorDialog>
+#include <QTextLayout>
+#include <QInputDialog>
+#include <QFontDialog>
+#include <QFontMetricsF>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CONTEXT_MENU_SSE2
+#include <emmintrin.h>
+#endif
+#include <coroutine>
+#include <optional>
+#include <type_traits>
+#include <exception>
+
+#include "menu_strategy_plugin.h"
 
 //*******************************************************************************************/
-//万能类型上下文
+// 通知
 //*******************************************************************************************/
-class CommandContext {
+// 非模态通知队列：命令只投递消息，按键聚合计数并限速刷新到显示端
+// 仅在GUI线程使用；无界面或基准测试模式下关闭，投递立即返回
+class NotificationCenter {
 public:
-    void* target = nullptr;                         // 可是任何图元、界面对象
-    QVariantMap extras;                             // 存储任意键值扩展
-    QGraphicsScene* scene = nullptr;                // 可选：传场景
-    QWidget* view = nullptr;                        // 可选：传视图
-    QGraphicsItem* item = nullptr;                  // 可选：传图元
+    static NotificationCenter& GetInstance() {
+        static NotificationCenter instance;
+        return instance;
+    }
+
+    using Sink = std::function<void(const QStringList& messages)>;
+
+    void setEnabled(bool on) {
+        enabled = on;
+        if (!on) {
+            pending.clear();
+            pendingIndex.clear();
+        }
+    }
+    bool isEnabled() const { return enabled; }
+
+    void setSink(Sink s) { sink = std::move(s); }
+
+    // 同一 key 的计数累加，format 中 %1 为合计数量，如 "已复制 %1 个图元"
+    void count(const QString& key, const char* format, qint64 n = 1) {
+        if (!enabled) return;
+        Pending& p = entry(key);
+        p.format = format;
+        p.total += n;
+        p.text.clear();
+        scheduleFlush();
+    }
+
+    // 普通消息，同一 key 只保留最新一条
+    void post(const QString& key, const QString& text) {
+        if (!enabled) return;
+        Pending& p = entry(key);
+        p.format = nullptr;
+        p.total = 0;
+        p.text = text;
+        scheduleFlush();
+    }
+
+private:
+    NotificationCenter() {
+        // 无界面平台与基准测试默认关闭
+        const QString platform = QGuiApplication::platformName();
+        enabled = platform != "offscreen" && platform != "minimal"
+                  && qEnvironmentVariableIsEmpty("CONTEXT_MENU_BENCHMARK");
+    }
+
+    struct Pending {
+        QString key;
+        const char* format = nullptr;
+        qint64 total = 0;
+        QString text;
+    };
+
+    Pending& entry(const QString& key) {
+        auto it = pendingIndex.constFind(key);
+        if (it != pendingIndex.constEnd()) return pending[it.value()];
+        pendingIndex.insert(key, pending.size());
+        pending.append(Pending());
+        pending.last().key = key;
+        return pending.last();
+    }
+
+    void scheduleFlush() {
+        if (flushScheduled) return;
+        flushScheduled = true;
+        // 距上次刷新不足最小间隔时推迟，批量操作期间只刷新一次
+        qint64 wait = 0;
+        if (lastFlush.isValid()) {
+            wait = qMax<qint64>(0, kMinIntervalMs - lastFlush.elapsed());
+        }
+        QTimer::singleShot(int(wait), qApp, [this]() { flush(); });
+    }
+
+    void flush() {
+        flushScheduled = false;
+        lastFlush.start();
+        if (pending.isEmpty()) return;
+        QStringList messages;
+        for (const Pending& p : pending) {
+            messages << (p.format ? QString::fromUtf8(p.format).arg(QLocale().toString(p.total)) : p.text);
+        }
+        pending.clear();
+        pendingIndex.clear();
+        if (sink) {
+            sink(messages);
+        } else {
+            for (const QString& m : messages) qInfo().noquote() << m;
+        }
+    }
+
+    static const int kMinIntervalMs = 400;
+
+    bool enabled = true;
+    bool flushScheduled = false;
+    QElapsedTimer lastFlush;
+    QVector<Pending> pending;            // 保持投递顺序
+    QHash<QString, int> pendingIndex;
+    Sink sink;
 };
 
-using CmdCtxPtr = std::shared_ptr<CommandContext>;
+// 视图底部的提示条，显示一段时间后自动隐藏
+class NotificationToast {
+public:
+    explicit NotificationToast(QWidget* host) : label(new QLabel(host)) {
+        label->setAttribute(Qt::WA_TransparentForMouseEvents);
+        label->setStyleSheet("background: rgba(40, 40, 40, 200); color: white; padding: 6px; border-radius: 4px;");
+        label->hide();
+        hideTimer.setSingleShot(true);
+        QObject::connect(&hideTimer, &QTimer::timeout, label, &QWidget::hide);
+    }
+
+    void show(const QStringList& messages) {
+        if (!label) return;
+        QWidget* host = label->parentWidget();
+        label->setText(messages.join("\n"));
+        label->adjustSize();
+        label->move((host->width() - label->width()) / 2, host->height() - label->height() - 12);
+        label->raise();
+        label->show();
+        hideTimer.start(kVisibleMs);
+    }
+
+private:
+    static const int kVisibleMs = 2500;
+
+    QPointer<QLabel> label;
+    QTimer hideTimer;
+};
 
 //*******************************************************************************************/
-//图元
+// 调色板
 //*******************************************************************************************/
-class BaseCustomItem : public QGraphicsItem {
+// 调色板索引的引用：存活期间该索引上的颜色不会被回收
+// 图元数据与撤销命令都通过它持有索引，复制时增加调色板上的引用计数
+class PaletteColor {
 public:
-    // 构造函数，使用默认构造函数
-    BaseCustomItem() = default;
-    virtual ~BaseCustomItem() = default;
+    PaletteColor(quint8 index = 0);
+    PaletteColor(const PaletteColor& other);
+    PaletteColor& operator=(const PaletteColor& other);
+    ~PaletteColor();
 
-    // 类型标识，用于菜单策略工厂匹配
-    virtual QString objectType() const = 0;
+    operator quint8() const { return index; }
 
-    virtual void copy() {
-        QMessageBox::information(nullptr, "Copy", "Copy action: objectType = " + objectType());
-    }
+private:
+    quint8 index;
 };
 
-class CustomItem : public BaseCustomItem {
+// 共享调色板：图元只保存一个字节的颜色索引
+// 每个图元类型的默认色占一个命名槽位，修改槽位颜色即重着色该类型所有仍用默认色的图元
+// 其余颜色按值共享同一索引；读取无锁（导出、自动保存线程也会读取），新增颜色加锁
+// 容量 256，用满后回收已无人引用的共享颜色；同时在用的颜色确实超过容量时才取最接近的已有颜色
+class ColorPalette {
 public:
-    QRectF boundingRect() const override {
-        return QRectF(0, 0, 100, 50);
+    static ColorPalette& GetInstance() {
+        static ColorPalette instance;
+        return instance;
     }
 
-    void paint(QPainter* painter, const QStyleOptionGraphicsItem*, QWidget*) override {
-        painter->setPen(QColor(70, 130, 180));
-        painter->drawRect(boundingRect());
-        painter->drawText(QPoint(10, 30), "TextItem");
+    QColor color(quint8 index) const {
+        return QColor::fromRgba(rgba(index));
     }
 
-    QString objectType() const override {
-        return "TextItem";  // 用于工厂查找
+    QRgb rgba(quint8 index) const {
+        return entries[index].load(std::memory_order_acquire);
+    }
+
+    // 命名槽位，首次使用时以 initial 创建；槽位不回收
+    quint8 slotFor(const QString& name, QRgb initial) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = namedSlots.constFind(name);
+        if (it != namedSlots.constEnd()) return it.value();
+        int index = allocateLocked();
+        if (index < 0) {
+            qWarning() << "color palette is full";
+            return nearestLocked(initial);
+        }
+        entries[index].store(initial, std::memory_order_release);
+        slotFlags[index].store(true, std::memory_order_release);
+        namedSlots.insert(name, quint8(index));
+        return quint8(index);
+    }
+
+    bool hasSlot(const QString& name) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return namedSlots.contains(name);
+    }
+
+    bool isSlot(quint8 index) const {
+        return slotFlags[index].load(std::memory_order_acquire);
+    }
+
+    QRgb slotColor(const QString& name) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return rgba(namedSlots.value(name));
+    }
+
+    void setSlotColor(const QString& name, QRgb value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = namedSlots.constFind(name);
+        if (it == namedSlots.constEnd()) return;
+        entries[it.value()].store(value, std::memory_order_release);
+        ++slotGeneration;
+    }
+
+    // 共享颜色的索引，不会返回命名槽位；返回的引用在加锁期间取得，不会被并发回收
+    PaletteColor indexOf(QRgb value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = shared.constFind(value);
+        if (it != shared.constEnd()) return PaletteColor(it.value());
+        int index = allocateLocked();
+        if (index < 0) {
+            qWarning() << "color palette is full";
+            return PaletteColor(nearestLocked(value));
+        }
+        entries[index].store(value, std::memory_order_release);
+        shared.insert(value, quint8(index));
+        return PaletteColor(quint8(index));
+    }
+
+    // 槽位颜色每修改一次加一，自动保存据此判断已编码的颜色是否失效
+    quint64 generation() const { return slotGeneration.load(); }
+
+private:
+    friend class PaletteColor;
+
+    ColorPalette() {
+        for (std::atomic<QRgb>& entry : entries) entry.store(0);
+        for (std::atomic<int>& use : uses) use.store(0);
+        for (std::atomic<bool>& flag : slotFlags) flag.store(false);
+        // 0 号为默认黑色，新建的图元数据指向它，不回收
+        entries[0].store(qRgb(0, 0, 0));
+        shared.insert(qRgb(0, 0, 0), quint8(count++));
+    }
+
+    void retain(quint8 index) {
+        uses[index].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release(quint8 index) {
+        uses[index].fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    // 取一个空位：先用未分配的，用满后回收无人引用的共享颜色；都没有时返回 -1
+    // 引用只能从已有引用复制或在加锁时取得，计数为 0 的索引此时不会被并发重新引用
+    int allocateLocked() {
+        if (count < kCapacity) return count++;
+        for (int i = 1; i < kCapacity; ++i) {
+            if (slotFlags[i].load(std::memory_order_relaxed) || uses[i].load(std::memory_order_acquire) != 0) continue;
+            auto it = shared.find(entries[i].load(std::memory_order_relaxed));
+            if (it != shared.end() && it.value() == i) shared.erase(it);
+            return i;
+        }
+        return -1;
+    }
+
+    quint8 nearestLocked(QRgb value) const {
+        int best = 0;
+        int bestDistance = std::numeric_limits<int>::max();
+        for (auto it = shared.constBegin(); it != shared.constEnd(); ++it) {
+            QRgb c = it.key();
+            int dr = qRed(c) - qRed(value), dg = qGreen(c) - qGreen(value);
+            int db = qBlue(c) - qBlue(value), da = qAlpha(c) - qAlpha(value);
+            int distance = dr * dr + dg * dg + db * db + da * da;
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = it.value();
+            }
+        }
+        return quint8(best);
     }
+
+    static const int kCapacity = 256;
+
+    std::atomic<QRgb> entries[kCapacity];
+    std::atomic<int> uses[kCapacity];           // PaletteColor 引用计数
+    std::atomic<bool> slotFlags[kCapacity];
+    int count = 0;
+    std::atomic<quint64> slotGeneration{0};
+    mutable std::mutex mutex;
+    QHash<QString, quint8> namedSlots;
+    QHash<QRgb, quint8> shared;
 };
 
-class CustomItem2 : public BaseCustomItem {
+inline PaletteColor::PaletteColor(quint8 index) : index(index) {
+    ColorPalette::GetInstance().retain(index);
+}
+
+inline PaletteColor::PaletteColor(const PaletteColor& other) : PaletteColor(other.index) {}
+
+inline PaletteColor& PaletteColor::operator=(const PaletteColor& other) {
+    if (index != other.index) {
+        ColorPalette::GetInstance().retain(other.index);
+        ColorPalette::GetInstance().release(index);
+        index = other.index;
+    }
+    return *this;
+}
+
+inline PaletteColor::~PaletteColor() {
+    ColorPalette::GetInstance().release(index);
+}
+
+//*******************************************************************************************/
+// 文本
+//*******************************************************************************************/
+// 不可变的平衡绳索（rope）：叶子保存文本片段，内部节点记录子树长度与换行数
+// 编辑只复制根到修改处的一条路径，复杂度 O(log n)，新旧版本共享其余节点
+// 节点不可变，值可以在线程间自由传递（导出、自动保存读取快照时无需加锁）
+class TextRope {
 public:
-    QRectF boundingRect() const override {
-        return QRectF(0, 0, 100, 50);
+    TextRope() = default;
+    TextRope(const QString& text) : root(build(text, 0, text.size())) {}
+    TextRope(const char* text) : TextRope(QString::fromUtf8(text)) {}
+
+    int length() const { return root ? root->length : 0; }
+    bool isEmpty() const { return !root; }
+    void clear() { root.reset(); }
+
+    // 段落按换行符划分，空文本也有一个段落
+    int paragraphCount() const { return (root ? root->newlines : 0) + 1; }
+
+    // pos 所在段落序号，即 pos 之前的换行数
+    int paragraphAt(int pos) const {
+        return countNewlines(root, qBound(0, pos, length()));
     }
 
-    void paint(QPainter* painter, const QStyleOptionGraphicsItem*, QWidget*) override {
-        painter->setPen(QColor(70, 130, 180));
-        painter->setBrush(QColor(70, 130, 180));
-        painter->drawRect(boundingRect());
+    // 段落起点
+    int paragraphStart(int index) const {
+        if (index <= 0) return 0;
+        return findNewline(root, index) + 1;
     }
 
-    QString objectType() const override {
-        return "Special";  // 这里填对应类型字符串，方便工厂查找
+    // 段落文本，不含换行符
+    QString paragraph(int index) const {
+        int start = paragraphStart(index);
+        int end = index + 1 < paragraphCount() ? paragraphStart(index + 1) - 1 : length();
+        return mid(start, end - start);
+    }
+
+    QString mid(int pos, int len) const {
+        QString out;
+        pos = qBound(0, pos, length());
+        len = qBound(0, len, length() - pos);
+        out.reserve(len);
+        appendTo(root, pos, len, out);
+        return out;
+    }
+
+    QString toString() const {
+        return mid(0, length());
+    }
+
+    TextRope replaced(int pos, int len, const QString& text) const {
+        pos = qBound(0, pos, length());
+        len = qBound(0, len, length() - pos);
+        auto head = split(root, pos);
+        auto tail = split(head.second, len);
+        return TextRope(join(join(head.first, build(text, 0, text.size())), tail.second));
+    }
+
+    TextRope inserted(int pos, const QString& text) const { return replaced(pos, 0, text); }
+    TextRope removed(int pos, int len) const { return replaced(pos, len, QString()); }
+
+    // 是否为同一版本（根节点相同）
+    bool isSameVersion(const TextRope& other) const { return root == other.root; }
+
+private:
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node {
+        NodePtr left, right;    // 内部节点两侧均非空
+        QString leaf;           // 仅叶子节点使用
+        int length = 0;
+        int newlines = 0;
+        int height = 0;         // 叶子为 0
+
+        bool isLeaf() const { return !left; }
+    };
+
+    explicit TextRope(NodePtr root) : root(std::move(root)) {}
+
+    static const int kLeafMax = 2048;
+
+    static NodePtr makeLeaf(const QString& text) {
+        if (text.isEmpty()) return nullptr;
+        std::shared_ptr<Node> node = std::make_shared<Node>();
+        node->leaf = text;
+        node->length = text.size();
+        node->newlines = text.count(QLatin1Char('\n'));
+        return node;
+    }
+
+    static NodePtr makeNode(const NodePtr& left, const NodePtr& right) {
+        std::shared_ptr<Node> node = std::make_shared<Node>();
+        node->left = left;
+        node->right = right;
+        node->length = left->length + right->length;
+        node->newlines = left->newlines + right->newlines;
+        node->height = qMax(left->height, right->height) + 1;
+        return node;
+    }
+
+    // 按叶子大小均分，得到高度平衡的树
+    static NodePtr build(const QString& text, int from, int to) {
+        if (to - from <= kLeafMax) return makeLeaf(text.mid(from, to - from));
+        int leaves = (to - from + kLeafMax - 1) / kLeafMax;
+        int middle = from + (leaves / 2) * kLeafMax;
+        return makeNode(build(text, from, middle), build(text, middle, to));
+    }
+
+    // 高度差超过 1 时旋转
+    static NodePtr rebalance(const NodePtr& left, const NodePtr& right) {
+        if (right->height > left->height + 1) {
+            if (right->right->height >= right->left->height) {
+                return makeNode(makeNode(left, right->left), right->right);
+            }
+            return makeNode(makeNode(left, right->left->left), makeNode(right->left->right, right->right));
+        }
+        if (left->height > right->height + 1) {
+            if (left->left->height >= left->right->height) {
+                return makeNode(left->left, makeNode(left->right, right));
+            }
+            return makeNode(makeNode(left->left, left->right->left), makeNode(left->right->right, right));
+        }
+        return makeNode(left, right);
+    }
+
+    // 连接两棵树，沿较高一侧的边下降到等高处再逐层回平衡；相邻小叶子直接合并
+    static NodePtr join(const NodePtr& left, const NodePtr& right) {
+        if (!left) return right;
+        if (!right) return left;
+        if (left->isLeaf() && right->isLeaf() && left->length + right->length <= kLeafMax) {
+            return makeLeaf(left->leaf + right->leaf);
+        }
+        if (left->height > right->height + 1) return rebalance(left->left, join(left->right, right));
+        if (right->height > left->height + 1) return rebalance(join(left, right->left), right->right);
+        return makeNode(left, right);
+    }
+
+    static std::pair<NodePtr, NodePtr> split(const NodePtr& node, int pos) {
+        if (!node) return {};
+        if (pos <= 0) return {nullptr, node};
+        if (pos >= node->length) return {node, nullptr};
+        if (node->isLeaf()) return {makeLeaf(node->leaf.left(pos)), makeLeaf(node->leaf.mid(pos))};
+
+        int leftLength = node->left->length;
+        if (pos < leftLength) {
+            auto parts = split(node->left, pos);
+            return {parts.first, join(parts.second, node->right)};
+        }
+        if (pos > leftLength) {
+            auto parts = split(node->right, pos - leftLength);
+            return {join(node->left, parts.first), parts.second};
+        }
+        return {node->left, node->right};
+    }
+
+    static void appendTo(const NodePtr& node, int pos, int len, QString& out) {
+        if (!node || len <= 0) return;
+        if (node->isLeaf()) {
+            out.append(node->leaf.constData() + pos, len);
+            return;
+        }
+        int leftLength = node->left->length;
+        if (pos < leftLength) {
+            int take = qMin(len, leftLength - pos);
+            appendTo(node->left, pos, take, out);
+            appendTo(node->right, 0, len - take, out);
+        } else {
+            appendTo(node->right, pos - leftLength, len, out);
+        }
+    }
+
+    static int countNewlines(const NodePtr& node, int pos) {
+        if (!node || pos <= 0) return 0;
+        if (pos >= node->length) return node->newlines;
+        if (node->isLeaf()) return int(std::count(node->leaf.constBegin(), node->leaf.constBegin() + pos, QChar('\n')));
+        int leftLength = node->left->length;
+        if (pos <= leftLength) return countNewlines(node->left, pos);
+        return node->left->newlines + countNewlines(node->right, pos - leftLength);
+    }
+
+    // 第 k 个换行符（从 1 计）的位置
+    static int findNewline(const NodePtr& node, int k) {
+        if (!node || k > node->newlines) return node ? node->length : 0;
+        if (node->isLeaf()) {
+            int at = -1;
+            for (int i = 0; i < k; ++i) at = node->leaf.indexOf(QLatin1Char('\n'), at + 1);
+            return at;
+        }
+        if (k <= node->left->newlines) return findNewline(node->left, k);
+        return node->left->length + findNewline(node->right, k - node->left->newlines);
     }
+
+    NodePtr root;
 };
 
-// Custom QGraphicsItem2
-class CustomItem3 : public CustomItem {
+// 进程级排版缓存：按（字体、宽度、段落文本）共享排好的 QTextLayout（含字形与度量）
+// 相同文本的图元共用一份排版；可在线程池中预先排版，绘制时直接命中
+// 排版结果只在GUI线程绘制，工作线程只负责生成
+class SharedLayoutCache {
 public:
-    QRectF boundingRect() const override {
-        return QRectF(0, 0, 50, 100);
+    static SharedLayoutCache& GetInstance() {
+        static SharedLayoutCache instance;
+        return instance;
     }
 
-    void paint(QPainter* painter, const QStyleOptionGraphicsItem*, QWidget*) override {
-        painter->setPen(QColor(211, 37, 167));
-        painter->setBrush(QColor(211, 37, 167));
-        // smooth
-        painter->setRenderHint(QPainter::Antialiasing, true);
-        painter->drawEllipse(boundingRect());
+    std::shared_ptr<const QTextLayout> layout(const QString& text, const QFont& font, qreal width) {
+        Key key{font.key(), qRound(width * 64), text};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (std::shared_ptr<const QTextLayout>* cached = cache.object(key)) return *cached;
+        }
+        // 排版在锁外进行，并发时同一文本可能排版两次，结果相同
+        std::shared_ptr<const QTextLayout> result = build(text, font, width);
+        std::lock_guard<std::mutex> lock(mutex);
+        cache.insert(key, new std::shared_ptr<const QTextLayout>(result), qMax(1, text.size()));
+        return result;
     }
 
-    QString objectType() const override {
-        return "Circle";  // 这里填对应类型字符串，方便工厂查找
+    static std::shared_ptr<const QTextLayout> build(const QString& text, const QFont& font, qreal width) {
+        std::shared_ptr<QTextLayout> result = std::make_shared<QTextLayout>(text, font);
+        result->beginLayout();
+        qreal height = 0;
+        for (QTextLine line = result->createLine(); line.isValid(); line = result->createLine()) {
+            line.setLineWidth(width);
+            line.setPosition(QPointF(0, height));
+            height += line.height();
+        }
+        result->endLayout();
+        return result;
     }
+
+private:
+    SharedLayoutCache() : cache(kMaxChars) {}
+
+    struct Key {
+        QString font;
+        int width;          // 1/64 像素
+        QString text;
+
+        bool operator==(const Key& other) const {
+            return width == other.width && font == other.font && text == other.text;
+        }
+    };
+
+    friend size_t qHash(const Key& key, size_t seed) {
+        return qHash(key.text, seed) ^ qHash(key.font, seed) ^ size_t(key.width);
+    }
+
+    static const int kMaxChars = 8 * 1024 * 1024;   // 按字符数计费
+
+    std::mutex mutex;
+    QCache<Key, std::shared_ptr<const QTextLayout>> cache;
 };
 
+// 段落排版缓存：每段一个 QTextLayout，编辑只让涉及的段落失效，绘制时按需排版可见段落
+// shared 为真时从进程级缓存取排版，只应在GUI线程使用
+class ParagraphLayoutCache {
+public:
+    explicit ParagraphLayoutCache(bool shared = false) : shared(shared) {}
+    // 与 text 同步；不是经 replace 得到的版本（如粘贴、对象池复用）时全部重排
+    void sync(const TextRope& text, qreal width, const QFont& font) {
+        if (!text.isSameVersion(source) || width != layoutWidth || font != layoutFont) {
+            entries.assign(size_t(text.paragraphCount()), nullptr);
+            source = text;
+            layoutWidth = width;
+            layoutFont = font;
+        }
+    }
+
+    // 段落 [first, first + removed) 被替换为 inserted 个新段落
+    void replace(const TextRope& text, int first, int removed, int inserted) {
+        if (first < 0 || first + removed > int(entries.size())) {
+            entries.assign(size_t(text.paragraphCount()), nullptr);
+        } else {
+            auto begin = entries.begin() + first;
+            entries.erase(begin, begin + removed);
+            entries.insert(entries.begin() + first, size_t(inserted), nullptr);
+        }
+        source = text;
+    }
+
+    // 自上而下绘制，超出 clip 的段落不排版
+    void paint(QPainter* painter, const QPointF& origin, const QRectF& clip) {
+        qreal y = origin.y();
+        for (size_t i = 0; i < entries.size() && y < clip.bottom(); ++i) {
+            if (!entries[i]) entries[i] = layout(source.paragraph(int(i)));
+            if (y + entries[i]->boundingRect().height() >= clip.top()) {
+                entries[i]->draw(painter, QPointF(origin.x(), y));
+            }
+            y += entries[i]->boundingRect().height();
+        }
+    }
+
+    // 距顶端 y 处的段落，只排版到 y 为止；超出全部段落时为最后一段
+    int paragraphAt(qreal y) {
+        qreal top = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (!entries[i]) entries[i] = layout(source.paragraph(int(i)));
+            top += entries[i]->boundingRect().height();
+            if (y < top) return int(i);
+        }
+        return qMax(0, int(entries.size()) - 1);
+    }
+
+    // 按与 paint 相同的规则估算可见段落，供批量预排版
+    static QVector<QString> visibleParagraphs(const TextRope& text, const QFont& font, qreal height) {
+        int lines = int(height / QFontMetricsF(font).lineSpacing()) + 1;
+        int count = qMin(lines, text.paragraphCount());
+        QVector<QString> result;
+        result.reserve(count);
+        for (int i = 0; i < count; ++i) result << text.paragraph(i);
+        return result;
+    }
+
+private:
+    std::shared_ptr<const QTextLayout> layout(const QString& text) const {
+        if (shared) return SharedLayoutCache::GetInstance().layout(text, layoutFont, layoutWidth);
+        return SharedLayoutCache::build(text, layoutFont, layoutWidth);
+    }
+
+    bool shared;
+    TextRope source;
+    qreal layoutWidth = -1;
+    QFont layoutFont;
+    std::vector<std::shared_ptr<const QTextLayout>> entries;
+};
 
 //*******************************************************************************************/
-// 右键命令
+//图元
 //*******************************************************************************************/
-// 命令接口
-class ICommand {
+// 图元数据：几何、样式、文本，序列化与剪贴板均以此为准
+// 写时复制共享：快照、复制只增加引用计数，修改时才真正拷贝
+struct ItemData : public QSharedData {
+    QSizeF size;
+    PaletteColor colorIndex;    // 调色板索引
+    TextRope text;
+    QFont font;                 // 文本图元使用，默认为应用字体
+    qreal rotation = 0;         // 绕 origin 旋转的角度
+    QPointF origin;             // 旋转原点（图元坐标）
+
+    QColor color() const {
+        return ColorPalette::GetInstance().color(colorIndex);
+    }
+
+    // 图元坐标到父坐标（不含位置）的变换，与 QGraphicsItem 的旋转约定一致
+    QTransform transform() const {
+        if (rotation == 0) return QTransform();
+        return QTransform::fromTranslate(origin.x(), origin.y()).rotate(rotation).translate(-origin.x(), -origin.y());
+    }
+};
+
+class BaseCustomItem;
+
+// 场景内全部自定义图元（含组合成员）的无序列表，图元进出场景时维护
+// 计数与按下标访问均为 O(1)，不经过场景索引，也不需要像 items() 那样收集排序
+// 另按Z键维护顶层图元的叠放次序，图元记住自己的位置，取相邻图元为 O(1)
+class SceneItemList : public QObject {
+public:
+    // 键相同时按加入先后，与 Qt 对同级同Z图元的叠放规则一致
+    using Stack = std::multimap<qreal, BaseCustomItem*>;
+
+    // 按需创建为场景子对象，指针记在场景属性中
+    static SceneItemList* of(QGraphicsScene* scene) {
+        if (SceneItemList* list = find(scene)) return list;
+        SceneItemList* list = new SceneItemList();
+        list->setParent(scene);
+        scene->setProperty("_itemList", QVariant::fromValue<QObject*>(list));
+        return list;
+    }
+
+    static SceneItemList* find(const QGraphicsScene* scene) {
+        if (!scene) return nullptr;
+        return static_cast<SceneItemList*>(scene->property("_itemList").value<QObject*>());
+    }
+
+    static int count(const QGraphicsScene* scene) {
+        SceneItemList* list = find(scene);
+        return list ? list->size() : 0;
+    }
+
+    int size() const { return int(items.size()); }
+    BaseCustomItem* at(int index) const { return items[size_t(index)]; }
+
+    // 返回图元所在下标
+    int append(BaseCustomItem* item) {
+        items.push_back(item);
+        return int(items.size()) - 1;
+    }
+
+    // 移除下标处的图元，末尾图元移入空位；返回被移动的图元，由调用方更新其下标
+    BaseCustomItem* takeAt(int index) {
+        BaseCustomItem* last = items.back();
+        items.pop_back();
+        if (index == int(items.size())) return nullptr;
+        items[size_t(index)] = last;
+        return last;
+    }
+
+    // 自底向上的顶层图元
+    const Stack& stack() const { return order; }
+    Stack::iterator stackInsert(qreal z, BaseCustomItem* item) { return order.emplace(z, item); }
+    void stackErase(Stack::iterator slot) { order.erase(slot); }
+
+private:
+    std::vector<BaseCustomItem*> items;
+    Stack order;
+};
+
+class BaseCustomItem : public QGraphicsItem {
 public:
-    virtual ~ICommand() = default;
-    virtual void execute(CmdCtxPtr ctx) = 0;
+    BaseCustomItem() : d(new ItemData()), itemId(nextItemId()) {
+        setFlags(ItemIsSelectable | ItemIsMovable | ItemSendsGeometryChanges);
+    }
+    virtual ~BaseCustomItem() {
+        leaveSceneList();
+    }
+
+    // 类型标识，用于菜单策略工厂匹配
+    virtual QString objectType() const = 0;
+
+    virtual void copy() {
+        NotificationCenter::GetInstance().count("copy", "已复制 %1 个图元");
+    }
+
+    QRectF boundingRect() const override {
+        return QRectF(QPointF(0, 0), d->size);
+    }
+
+    // 只读访问不触发拷贝（非 const 函数里 d-> 读取也会拷贝，应改用此函数）
+    const ItemData& itemData() const {
+        return *d;
+    }
+
+    QSharedDataPointer<ItemData> sharedData() const {
+        return d;
+    }
+
+    void setItemData(const QSharedDataPointer<ItemData>& data) {
+        prepareGeometryChange();
+        d = data;
+        ++itemRevision;
+        applyRotation();
+        notifyParent();
+        update();
+    }
+
+    // 旋转记在图元数据中，随复制、剪贴板、保存、换出一起保留
+    void setItemRotation(qreal angle, const QPointF& origin) {
+        if (itemData().rotation == angle && itemData().origin == origin) return;
+        ItemData* data = mutableData();
+        data->rotation = angle;
+        data->origin = origin;
+        applyRotation();
+    }
+
+    // 父坐标系下的位置映射到场景，不含自身旋转（scenePos() 会把自身旋转算进去）
+    QPointF positionInScene() const {
+        return parentItem() ? parentItem()->mapToScene(pos()) : pos();
+    }
+
+    void setSize(const QSizeF& size) {
+        if (itemData().size == size) return;
+        prepareGeometryChange();
+        mutableData()->size = size;
+        notifyParent();
+        update();
+    }
+
+    // 只改索引不单独重绘，批量修改后由调用方统一重绘场景
+    void setColorIndex(quint8 index) {
+        if (itemData().colorIndex == index) return;
+        mutableData()->colorIndex = index;
+    }
+
+    // 稳定标识与修改版本，供增量保存判断图元是否变化
+    quint64 id() const { return itemId; }
+    quint64 revision() const { return itemRevision; }
+
+protected:
+    // 选中时绘制虚线外框
+    void paintSelection(QPainter* painter) {
+        if (!isSelected()) return;
+        painter->setPen(QPen(Qt::black, 0, Qt::DashLine));
+        painter->setBrush(Qt::NoBrush);
+        painter->drawRect(boundingRect());
+    }
+
+    QVariant itemChange(GraphicsItemChange change, const QVariant& value) override {
+        if (change == ItemSceneChange) {
+            leaveSceneList();
+            if (QGraphicsScene* next = value.value<QGraphicsScene*>()) {
+                SceneItemList* list = SceneItemList::of(next);
+                sceneSlot = list->append(this);
+                if (!parentItem()) enterStack(list);
+            }
+        }
+        // 只有顶层图元参与叠放次序，收入组合时移出，释放回顶层时重新加入
+        if (change == ItemParentHasChanged) {
+            leaveStack();
+            if (!parentItem() && scene()) enterStack(SceneItemList::of(scene()));
+        }
+        if (change == ItemZValueHasChanged && stacked) {
+            SceneItemList* list = SceneItemList::find(scene());
+            list->stackErase(stackSlot);
+            stackSlot = list->stackInsert(zValue(), this);
+        }
+        if (change == ItemPositionHasChanged) ++itemRevision;
+        if (change == ItemPositionHasChanged || change == ItemRotationHasChanged
+            || change == ItemScaleHasChanged || change == ItemTransformHasChanged) {
+            notifyParent();
+        }
+        return QGraphicsItem::itemChange(change, value);
+    }
+
+    // 子图元几何变化时由子图元调用，组合据此更新外框
+    virtual void childGeometryChanged(BaseCustomItem* child) {}
+
+    // 顶层图元在叠放次序中的位置，仅在 isStacked() 时有效
+    bool isStacked() const { return stacked; }
+    SceneItemList::Stack::const_iterator stackPosition() const { return stackSlot; }
+
+    void notifyParent() {
+        if (!parentItem()) return;
+        if (BaseCustomItem* parent = dynamic_cast<BaseCustomItem*>(parentItem())) parent->childGeometryChanged(this);
+    }
+
+    // 修改数据前调用，共享时先拷贝一份
+    ItemData* mutableData() {
+        ++itemRevision;
+        return d.data();
+    }
+
+    QSharedDataPointer<ItemData> d;
+
+private:
+    static quint64 nextItemId() {
+        static quint64 next = 0;
+        return ++next;
+    }
+
+    // 只在值变化时调用，未旋转的图元不会分配 Qt 的变换数据
+    void applyRotation() {
+        if (transformOriginPoint() != itemData().origin) setTransformOriginPoint(itemData().origin);
+        if (rotation() != itemData().rotation) setRotation(itemData().rotation);
+    }
+
+    void leaveSceneList() {
+        leaveStack();
+        if (sceneSlot < 0) return;
+        if (SceneItemList* list = SceneItemList::find(scene())) {
+            if (BaseCustomItem* moved = list->takeAt(sceneSlot)) moved->sceneSlot = sceneSlot;
+        }
+        sceneSlot = -1;
+    }
+
+    void enterStack(SceneItemList* list) {
+        stackSlot = list->stackInsert(zValue(), this);
+        stacked = true;
+    }
+
+    void leaveStack() {
+        if (!stacked) return;
+        if (SceneItemList* list = SceneItemList::find(scene())) list->stackErase(stackSlot);
+        stacked = false;
+    }
+
+    quint64 itemId;
+    quint64 itemRevision = 0;
+    int sceneSlot = -1;     // 在 SceneItemList 中的下标
+    SceneItemList::Stack::iterator stackSlot;
+    bool stacked = false;
+};
+
+class CustomItem : public BaseCustomItem {
+public:
+    CustomItem() {
+        d->size = QSizeF(100, 50);
+        static const quint8 defaultColor = ColorPalette::GetInstance().slotFor("TextItem", qRgb(70, 130, 180));
+        d->colorIndex = defaultColor;
+        d->text = "TextItem";
+    }
+
+    void paint(QPainter* painter, const QStyleOptionGraphicsItem*, QWidget*) override {
+        const ItemData& data = itemData();
+        drawFrame(painter, data);
+        layoutCache.sync(data.text, textRect(data.size).width(), data.font);
+        drawText(painter, data, layoutCache);
+        paintSelection(painter);
+    }
+
+    // 只依赖数据，可在导出线程中绘制
+    static void drawShape(QPainter* painter, const ItemData& data) {
+        drawFrame(painter, data);
+        ParagraphLayoutCache cache;
+        cache.sync(data.text, textRect(data.size).width(), data.font);
+        drawText(painter, data, cache);
+    }
+
+    // 替换文本，只让涉及的段落重新排版
+    void setText(const TextRope& text, int firstParagraph, int removed, int inserted) {
+        layoutCache.replace(text, firstParagraph, removed, inserted);
+        mutableData()->text = text;
+        update();
+    }
+
+    // 图元坐标 pos 处的段落，与绘制使用同一份排版
+    int paragraphAt(const QPointF& pos) {
+        const ItemData& data = itemData();
+        const QRectF rect = textRect(data.size);
+        layoutCache.sync(data.text, rect.width(), data.font);
+        return layoutCache.paragraphAt(pos.y() - rect.top());
+    }
+
+    // 只改数据不单独重绘，批量修改后由调用方统一重绘场景
+    void setFont(const QFont& font) {
+        if (itemData().font == font) return;
+        mutableData()->font = font;
+    }
+
+    QString objectType() const override {
+        return QStringLiteral("TextItem");  // 用于工厂查找
+    }
+
+    static QRectF textRect(const QSizeF& size) {
+        return QRectF(QPointF(0, 0), size).adjusted(10, 16, -10, -4);
+    }
+
+private:
+    static void drawFrame(QPainter* painter, const ItemData& data) {
+        painter->setPen(data.color());
+        painter->setBrush(Qt::NoBrush);
+        painter->drawRect(QRectF(QPointF(0, 0), data.size));
+    }
+
+    static void drawText(QPainter* painter, const ItemData& data, ParagraphLayoutCache& cache) {
+        QRectF rect = textRect(data.size);
+        painter->save();
+        painter->setClipRect(rect, Qt::IntersectClip);
+        cache.paint(painter, rect.topLeft(), rect);
+        painter->restore();
+    }
+
+    ParagraphLayoutCache layoutCache{true};
+};
+
+class CustomItem2 : public BaseCustomItem {
+public:
+    CustomItem2() {
+        d->size = QSizeF(100, 50);
+        static const quint8 defaultColor = ColorPalette::GetInstance().slotFor("Special", qRgb(70, 130, 180));
+        d->colorIndex = defaultColor;
+    }
+
+    void paint(QPainter* painter, const QStyleOptionGraphicsItem*, QWidget*) override {
+        drawShape(painter, itemData());
+        paintSelection(painter);
+    }
+
+    static void drawShape(QPainter* painter, const ItemData& data) {
+        painter->setPen(data.color());
+        painter->setBrush(data.color());
+        painter->drawRect(QRectF(QPointF(0, 0), data.size));
+    }
+
+    QString objectType() const override {
+        return QStringLiteral("Special");  // 这里填对应类型字符串，方便工厂查找
+    }
+};
+
+// Custom QGraphicsItem2
+class CustomItem3 : public CustomItem {
+public:
+    CustomItem3() {
+        d->size = QSizeF(50, 100);
+        static const quint8 defaultColor = ColorPalette::GetInstance().slotFor("Circle", qRgb(211, 37, 167));
+        d->colorIndex = defaultColor;
+        d->text.clear();
+    }
+
+    void paint(QPainter* painter, const QStyleOptionGraphicsItem*, QWidget*) override {
+        drawShape(painter, itemData());
+        paintSelection(painter);
+    }
+
+    static void drawShape(QPainter* painter, const ItemData& data) {
+        painter->setPen(data.color());
+        painter->setBrush(data.color());
+        // smooth
+        painter->setRenderHint(QPainter::Antialiasing, true);
+        painter->drawEllipse(QRectF(QPointF(0, 0), data.size));
+    }
+
+    QString objectType() const override {
+        return QStringLiteral("Circle");  // 这里填对应类型字符串，方便工厂查找
+    }
+};
+
+// 组合：子图元以组合为父项，位置相对组合
+// 外框由各子图元的外框缓存合成，子图元变化时增量更新：超出外框直接合并，原先贴边的子图元变化才标记重算
+// 组合期间子图元不可单独选中、拖动，鼠标事件落到组合上；组合本身的数据不含尺寸，几何以 boundingRect() 为准
+// 序列化时组合作为一条记录写在成员之前，成员记录所属组合，插入后重新收入
+class GroupItem : public BaseCustomItem {
+public:
+    QString objectType() const override {
+        return QStringLiteral("Group");
+    }
+
+    QRectF boundingRect() const override {
+        if (boundsDirty) {
+            bounds = QRectF();
+            for (const QRectF& rect : childRects) bounds |= rect;
+            boundsDirty = false;
+        }
+        return bounds;
+    }
+
+    void paint(QPainter* painter, const QStyleOptionGraphicsItem*, QWidget*) override {
+        paintSelection(painter);
+    }
+
+    // 收入子图元，保持其场景位置；调用方负责暂停索引
+    void adopt(const QList<BaseCustomItem*>& items) {
+        prepareGeometryChange();
+        members = items;
+        childRects.clear();
+        childRects.reserve(items.size());
+        bounds = QRectF();
+        boundsDirty = false;
+        for (BaseCustomItem* item : items) {
+            const QPointF scenePosition = item->positionInScene();
+            item->setSelected(false);
+            item->setFlag(ItemIsSelectable, false);
+            item->setFlag(ItemIsMovable, false);
+            item->setParentItem(this);
+            item->setPos(mapFromScene(scenePosition));
+            const QRectF rect = item->mapRectToParent(item->boundingRect());
+            childRects.insert(item, rect);
+            bounds |= rect;
+        }
+    }
+
+    // 释放全部子图元回到场景顶层，返回原收入顺序
+    QList<BaseCustomItem*> release() {
+        prepareGeometryChange();
+        childRects.clear();
+        bounds = QRectF();
+        boundsDirty = false;
+        QList<BaseCustomItem*> items;
+        items.swap(members);
+        for (BaseCustomItem* item : items) {
+            const QPointF scenePosition = item->positionInScene();
+            item->setParentItem(nullptr);
+            item->setPos(scenePosition);
+            item->setFlags(ItemIsSelectable | ItemIsMovable | ItemSendsGeometryChanges);
+        }
+        return items;
+    }
+
+protected:
+    void childGeometryChanged(BaseCustomItem* child) override {
+        auto it = childRects.find(child);
+        if (it == childRects.end()) return;
+        const QRectF before = it.value();
+        const QRectF now = child->mapRectToParent(child->boundingRect());
+        it.value() = now;
+        if (boundsDirty) return;     // 已等待重算
+
+        const QRectF& current = bounds;
+        bool onEdge = before.left() <= current.left() || before.top() <= current.top()
+                      || before.right() >= current.right() || before.bottom() >= current.bottom();
+        if (onEdge) {
+            prepareGeometryChange();
+            boundsDirty = true;
+        } else if (!current.contains(now)) {
+            prepareGeometryChange();
+            bounds |= now;
+        }
+    }
+
+private:
+    QList<BaseCustomItem*> members;
+    QHash<BaseCustomItem*, QRectF> childRects;  // 父坐标系下的子图元外框
+    mutable QRectF bounds;
+    mutable bool boundsDirty = false;
+};
+
+// 图元工厂，按类型字符串创建图元（加载、粘贴等场景共用）
+class ItemFactory {
+public:
+    using Creator = std::function<BaseCustomItem*()>;
+    using Painter = std::function<void(QPainter*, const ItemData&)>;
+
+    // 单例
+    static ItemFactory& GetInstance() {
+        static ItemFactory factory;
+        return factory;
+    }
+
+    void registerCreator(const QString& type, Creator creator) {
+        creators[type] = creator;
+    }
+
+    BaseCustomItem* create(const QString& type) const {
+        auto it = creators.constFind(type);
+        if (it != creators.constEnd()) {
+            return it.value()();
+        }
+        return nullptr;
+    }
+
+    // 脱离图元对象、只依据数据绘制，供离屏导出使用
+    void registerPainter(const QString& type, Painter painter) {
+        painters[type] = painter;
+    }
+
+    Painter painter(const QString& type) const {
+        return painters.value(type);
+    }
+
+private:
+    QMap<QString, Creator> creators;
+    QMap<QString, Painter> painters;
+};
+
+
+// 批量增删图元时暂停BSP索引，最外层结束时一次性重建（支持嵌套）
+// 切换索引方式会对全场景重新收集排序并建树，代价随场景规模增长，
+// 所以只在批量占场景相当比例时暂停，小批量仍逐个更新索引
+class SceneIndexSuspender {
+public:
+    // batchSize 为本次涉及的图元数，省略表示规模未知的批量导入，总是暂停
+    explicit SceneIndexSuspender(QGraphicsScene* scene, int batchSize = -1) : scene(scene) {
+        if (!scene) return;
+        int depth = scene->property("_indexSuspendDepth").toInt();
+        if (depth == 0) {
+            if (batchSize >= 0 && !worthSuspending(scene, batchSize)) {
+                this->scene = nullptr;
+                return;
+            }
+            scene->setProperty("_indexMethod", int(scene->itemIndexMethod()));
+            scene->setItemIndexMethod(QGraphicsScene::NoIndex);
+        }
+        scene->setProperty("_indexSuspendDepth", depth + 1);
+    }
+
+    ~SceneIndexSuspender() {
+        if (!scene) return;
+        int depth = scene->property("_indexSuspendDepth").toInt() - 1;
+        scene->setProperty("_indexSuspendDepth", depth);
+        if (depth == 0) {
+            // 切回BSP时Qt会对全部图元一次性建树，而不是逐个插入
+            scene->setItemIndexMethod(QGraphicsScene::ItemIndexMethod(scene->property("_indexMethod").toInt()));
+        }
+    }
+
+    static bool worthSuspending(const QGraphicsScene* scene, int batchSize) {
+        return batchSize >= kMinBatch && qint64(batchSize) * kSceneFraction >= SceneItemList::count(scene);
+    }
+
+private:
+    static const int kMinBatch = 512;       // 低于此数量逐个更新总是更快
+    static const int kSceneFraction = 4;    // 批量至少占场景图元的 1/4
+
+
+    QPointer<QGraphicsScene> scene;
+};
+
+// 撤销栈，记录每条命令最近一次执行、撤销的全局先后
+// 页面（场景）与文档各有一个栈，撤销、重做时据此决定先作用于哪一个
+class OrderedUndoStack : public QUndoStack {
+public:
+    explicit OrderedUndoStack(QObject* parent) : QUndoStack(parent) {
+        connect(this, &QUndoStack::indexChanged, this, [this](int index) { record(index); });
+    }
+
+    // 下一条可撤销命令最近执行的时刻，0 表示没有
+    quint64 undoStamp() const {
+        return canUndo() && index() <= int(done.size()) ? done[size_t(index() - 1)] : 0;
+    }
+
+    // 下一条可重做命令最近撤销的时刻，0 表示没有
+    quint64 redoStamp() const {
+        return canRedo() && index() < int(undone.size()) ? undone[size_t(index())] : 0;
+    }
+
+    // 在多个栈中撤销最近执行的命令，或重做最近撤销的命令
+    static void stepLatest(const QList<QUndoStack*>& stacks, bool redo) {
+        OrderedUndoStack* latest = nullptr;
+        quint64 latestStamp = 0;
+        for (QUndoStack* stack : stacks) {
+            OrderedUndoStack* ordered = dynamic_cast<OrderedUndoStack*>(stack);
+            quint64 stamp = !ordered ? 0 : redo ? ordered->redoStamp() : ordered->undoStamp();
+            if (stamp > latestStamp) {
+                latest = ordered;
+                latestStamp = stamp;
+            }
+        }
+        if (!latest) return;
+        if (redo) latest->redo();
+        else latest->undo();
+    }
+
+private:
+    void record(int now) {
+        const size_t size = size_t(qMax(count(), last));
+        done.resize(size);
+        undone.resize(size);
+        for (int i = last; i < now; ++i) done[size_t(i)] = ++clock();
+        for (int i = now; i < last; ++i) undone[size_t(i)] = ++clock();
+        last = now;
+    }
+
+    static quint64& clock() {
+        static quint64 value = 0;
+        return value;
+    }
+
+    std::vector<quint64> done;
+    std::vector<quint64> undone;
+    int last = 0;
+};
+
+// 场景或文档的撤销栈，作为其子对象按需创建
+QUndoStack* undoStackFor(QObject* owner) {
+    QUndoStack* stack = owner->findChild<QUndoStack*>(QString(), Qt::FindDirectChildrenOnly);
+    if (!stack) stack = new OrderedUndoStack(owner);
+    return stack;
+}
+
+// 场景所属的文档，不属于文档时为场景本身；跨页面的修改（如类型默认色）记在文档的撤销栈上
+QObject* documentOf(QGraphicsScene* scene);
+
+// 稀疏Z键：置顶/置底在当前最上/最下键之外按固定间距分配，移到两项之间时取两键中点
+// 最上/最下键取自场景的叠放次序；中点间距过小时按叠放次序整体重新编号（少见）
+class ZOrderKeys {
+public:
+    static constexpr qreal kGap = 1024;
+    static constexpr qreal kMinGap = 1e-6;
+
+    static qreal nextTop(QGraphicsScene* scene) {
+        const SceneItemList::Stack& stack = SceneItemList::of(scene)->stack();
+        return stack.empty() ? kGap : qMax<qreal>(0, stack.crbegin()->first) + kGap;
+    }
+
+    static qreal nextBottom(QGraphicsScene* scene) {
+        const SceneItemList::Stack& stack = SceneItemList::of(scene)->stack();
+        return stack.empty() ? -kGap : qMin<qreal>(0, stack.cbegin()->first) - kGap;
+    }
+
+    // 按当前叠放次序重新编号场景中全部顶层图元，首次修改的图元原键记入 oldKeys
+    // 沿叠放次序遍历，不收集排序场景图元
+    static void renumber(QGraphicsScene* scene, QHash<BaseCustomItem*, qreal>& oldKeys) {
+        const SceneItemList::Stack& stack = SceneItemList::of(scene)->stack();
+        std::vector<BaseCustomItem*> items;
+        items.reserve(stack.size());
+        for (const auto& entry : stack) items.push_back(entry.second);
+
+        qreal key = 0;
+        for (BaseCustomItem* item : items) {
+            key += kGap;
+            if (!oldKeys.contains(item)) oldKeys.insert(item, item->zValue());
+            item->setZValue(key);
+        }
+    }
+};
+
+// 有界批次队列：工作线程生产，GUI线程按时间片非阻塞消费
+template <typename T>
+class BatchQueue {
+public:
+    explicit BatchQueue(size_t capacity = 64) : capacity(capacity) {}
+
+    // 生产端，队列满时阻塞，限制生产者领先的距离；已取消时返回 false
+    bool push(T&& batch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]() { return cancelled || batches.size() < capacity; });
+        if (cancelled) return false;
+        batches.push_back(std::move(batch));
+        return true;
+    }
+
+    // 生产结束
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+
+    // 消费端，不阻塞
+    bool tryPop(T& batch) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (batches.empty()) return false;
+            batch = std::move(batches.front());
+            batches.pop_front();
+        }
+        cond.notify_one();
+        return true;
+    }
+
+    bool isDrained() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed && batches.empty();
+    }
+
+    void cancel() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cancelled = true;
+        }
+        cond.notify_all();
+    }
+
+    bool isCancelled() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cancelled;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        batches.clear();
+        closed = false;
+        cancelled = false;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<T> batches;
+    size_t capacity;
+    bool closed = false;
+    bool cancelled = false;
+};
+
+// 图元对象池，粘贴、撤销时复用已分配的图元，避免反复 new/delete
+class ItemPool {
+public:
+    // 单例
+    static ItemPool& GetInstance() {
+        static ItemPool pool;
+        return pool;
+    }
+
+    BaseCustomItem* acquire(const QString& type) {
+        auto it = freeItems.find(type);
+        if (it != freeItems.end() && !it.value().empty()) {
+            BaseCustomItem* item = it.value().back();
+            it.value().pop_back();
+            return item;
+        }
+        return ItemFactory::GetInstance().create(type);
+    }
+
+    // 归还前需已从场景移除
+    void release(BaseCustomItem* item) {
+        if (!item) return;
+        std::vector<BaseCustomItem*>& list = freeItems[item->objectType()];
+        // 带子图元的（组合）不复用，连同子图元一起释放
+        if (list.size() >= kMaxPerType || !item->childItems().isEmpty()) {
+            delete item;
+            return;
+        }
+        item->setSelected(false);
+        item->setPos(0, 0);
+        item->setZValue(0);
+        item->setItemRotation(0, QPointF());
+        item->setScale(1);
+        list.push_back(item);
+    }
+
+private:
+    // 池中图元的数据持有调色板引用，先构造调色板以保证其晚于对象池析构
+    ItemPool() {
+        ColorPalette::GetInstance();
+    }
+    ~ItemPool() {
+        for (auto it = freeItems.begin(); it != freeItems.end(); ++it) {
+            qDeleteAll(it.value());
+        }
+    }
+
+    static const size_t kMaxPerType = 65536;
+    QHash<QString, std::vector<BaseCustomItem*>> freeItems;
+};
+
+
+//*******************************************************************************************/
+// 剪贴板格式
+//*******************************************************************************************/
+// 图元序列化记录
+struct ItemRecord {
+    QString type;
+    QPointF pos;
+    QSharedDataPointer<ItemData> data;
+    quint64 id = 0;         // 写入时图元的 id，用于还原组合
+    quint64 parent = 0;     // 所属组合的 id，0 为顶层
+};
+
+// 二进制布局（小端）：
+//   头部   magic "CMIT" u32 | version u16 | typeCount u16 | itemCount u32 | bounds f64 x4
+//   类型表 typeCount 个 { len u16 | UTF-8 }
+//   记录   itemCount 个 { type u16 | x f32 | y f32 | w f32 | h f32 | argb u32 | textLen u32 | UTF-8
+//                       | fontLen u16 | QFont::toString() UTF-8 }   （版本 2 起有字体，默认字体长度为 0）
+//                       | rotation f32 | originX f32 | originY f32 }  （版本 3 起）
+//                       | flags u8 }  （版本 4 起，kOnTypeSlot：使用该类型的默认色槽位，argb 仅供参考）
+//                       | id u64 | parent u64 }  （版本 5 起，组合为类型 "Group" 的记录，成员记录的 parent 为其 id）
+//   位置为不含自身旋转的场景位置，旋转绕 origin 进行；组合先于其成员写出
+namespace ItemClipboard {
+const char* const kMimeType = "application/x-context-menu-items";
+const quint32 kMagic = 0x54494d43;
+const quint16 kVersion = 5;
+const quint8 kOnTypeSlot = 0x01;
+
+template <typename T>
+void put(QByteArray& out, T value) {
+    value = qToLittleEndian(value);
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void putFloat(QByteArray& out, float value) {
+    quint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put<quint32>(out, bits);
+}
+
+void putDouble(QByteArray& out, double value) {
+    quint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put<quint64>(out, bits);
+}
+
+void putHeader(QByteArray& out, const QStringList& types, quint32 itemCount, const QRectF& bounds) {
+    put<quint32>(out, kMagic);
+    put<quint16>(out, kVersion);
+    put<quint16>(out, quint16(types.size()));
+    put<quint32>(out, itemCount);
+    putDouble(out, bounds.x());
+    putDouble(out, bounds.y());
+    putDouble(out, bounds.width());
+    putDouble(out, bounds.height());
+
+    for (const QString& type : types) {
+        QByteArray name = type.toUtf8();
+        put<quint16>(out, quint16(name.size()));
+        out.append(name);
+    }
+}
+
+void putRecord(QByteArray& out, quint16 type, const QPointF& pos, const ItemData& data, quint64 id, quint64 parent) {
+    QByteArray text = data.text.toString().toUtf8();
+    put<quint16>(out, type);
+    putFloat(out, float(pos.x()));
+    putFloat(out, float(pos.y()));
+    putFloat(out, float(data.size.width()));
+    putFloat(out, float(data.size.height()));
+    put<quint32>(out, ColorPalette::GetInstance().rgba(data.colorIndex));
+    put<quint32>(out, quint32(text.size()));
+    out.append(text);
+
+    static const QFont defaultFont;
+    QByteArray font = data.font == defaultFont ? QByteArray() : data.font.toString().toUtf8();
+    put<quint16>(out, quint16(font.size()));
+    out.append(font);
+
+    putFloat(out, float(data.rotation));
+    putFloat(out, float(data.origin.x()));
+    putFloat(out, float(data.origin.y()));
+
+    put<quint8>(out, ColorPalette::GetInstance().isSlot(data.colorIndex) ? kOnTypeSlot : 0);
+
+    put<quint64>(out, id);
+    put<quint64>(out, parent);
+}
+
+// 组合展开为其中的图元
+void appendFlattened(QList<BaseCustomItem*>& out, BaseCustomItem* item) {
+    if (item->objectType() != "Group") {
+        out << item;
+        return;
+    }
+    for (QGraphicsItem* child : item->childItems()) {
+        if (BaseCustomItem* baseChild = dynamic_cast<BaseCustomItem*>(child)) appendFlattened(out, baseChild);
+    }
+}
+
+// 组合与其成员按前序排列，每项附带所属组合的 id
+void appendTree(QList<QPair<BaseCustomItem*, quint64>>& out, BaseCustomItem* item, quint64 parent) {
+    out << qMakePair(item, parent);
+    if (item->objectType() != "Group") return;
+    for (QGraphicsItem* child : item->childItems()) {
+        if (BaseCustomItem* baseChild = dynamic_cast<BaseCustomItem*>(child)) appendTree(out, baseChild, item->id());
+    }
+}
+
+QByteArray encode(const QList<BaseCustomItem*>& selection) {
+    QList<QPair<BaseCustomItem*, quint64>> items;
+    items.reserve(selection.size());
+    for (BaseCustomItem* item : selection) {
+        appendTree(items, item, 0);
+    }
+
+    QStringList types;
+    QHash<QString, quint16> typeIndex;
+    QRectF bounds;
+    for (const auto& entry : items) {
+        QString type = entry.first->objectType();
+        if (!typeIndex.contains(type)) {
+            typeIndex.insert(type, quint16(types.size()));
+            types << type;
+        }
+        if (type != "Group") bounds |= entry.first->sceneBoundingRect();
+    }
+
+    QByteArray out;
+    out.reserve(44 + items.size() * 48);
+    putHeader(out, types, quint32(items.size()), bounds);
+    for (const auto& entry : items) {
+        BaseCustomItem* item = entry.first;
+        putRecord(out, typeIndex.value(item->objectType()), item->positionInScene(), item->itemData(), item->id(), entry.second);
+    }
+    return out;
+}
+}
+
+// 顺序读取剪贴板数据，直接在共享的 QByteArray 上解析，不复制负载
+class ItemPayloadReader {
+public:
+    explicit ItemPayloadReader(const QByteArray& payload)
+        : payload(payload), p(this->payload.constData()), end(this->payload.constData() + this->payload.size()) {
+        valid = readHeader();
+    }
+
+    bool isValid() const { return valid; }
+    quint32 count() const { return itemCount; }
+    quint32 readCount() const { return itemsRead; }
+    QRectF bounds() const { return itemBounds; }
+
+    bool next(ItemRecord& record) {
+        if (!valid || itemsRead >= itemCount) return false;
+
+        quint16 type = 0;
+        float x = 0, y = 0, w = 0, h = 0;
+        quint32 argb = 0, textLen = 0;
+        if (!read(type) || !readFloat(x) || !readFloat(y) || !readFloat(w) || !readFloat(h)
+            || !read(argb) || !read(textLen) || type >= types.size() || end - p < qint64(textLen)) {
+            valid = false;
+            return false;
+        }
+
+        record.type = types.at(type);
+        record.pos = QPointF(x, y);
+        ItemData* data = new ItemData();
+        record.data = data;
+        data->size = QSizeF(w, h);
+        data->text = textLen ? QString::fromUtf8(p, int(textLen)) : QString();
+        p += textLen;
+
+        if (version >= 2) {
+            quint16 fontLen = 0;
+            if (!read(fontLen) || end - p < fontLen) {
+                valid = false;
+                return false;
+            }
+            // 同样缓存上次解析的字体
+            QByteArray font = QByteArray::fromRawData(p, fontLen);
+            if (font != lastFont) {
+                lastFont = QByteArray(p, fontLen);
+                lastParsedFont = QFont();
+                if (fontLen) lastParsedFont.fromString(QString::fromUtf8(lastFont));
+            }
+            data->font = lastParsedFont;
+            p += fontLen;
+        }
+
+        if (version >= 3) {
+            float rotation = 0, originX = 0, originY = 0;
+            if (!readFloat(rotation) || !readFloat(originX) || !readFloat(originY)) {
+                valid = false;
+                return false;
+            }
+            data->rotation = rotation;
+            data->origin = QPointF(originX, originY);
+        }
+
+        quint8 flags = 0;
+        if (version >= 4 && !read(flags)) {
+            valid = false;
+            return false;
+        }
+        data->colorIndex = (flags & ItemClipboard::kOnTypeSlot) ? PaletteColor(typeSlot(type, argb)) : sharedColor(argb);
+
+        record.id = 0;
+        record.parent = 0;
+        if (version >= 5 && (!read(record.id) || !read(record.parent))) {
+            valid = false;
+            return false;
+        }
+        ++itemsRead;
+        return true;
+    }
+
+private:
+    // 连续记录多为同一颜色，缓存上次的索引，减少调色板加锁
+    PaletteColor sharedColor(QRgb argb) {
+        if (argb != lastArgb || !hasLastColor) {
+            lastArgb = argb;
+            lastColorIndex = ColorPalette::GetInstance().indexOf(argb);
+            hasLastColor = true;
+        }
+        return lastColorIndex;
+    }
+
+    // 默认色图元回到本进程中该类型的槽位，槽位尚未创建时以记录中的颜色创建
+    quint8 typeSlot(quint16 type, QRgb argb) {
+        auto it = typeSlots.constFind(type);
+        if (it != typeSlots.constEnd()) return it.value();
+        quint8 index = ColorPalette::GetInstance().slotFor(types.at(type), argb);
+        typeSlots.insert(type, index);
+        return index;
+    }
+
+    template <typename T>
+    bool read(T& value) {
+        if (end - p < qint64(sizeof(T))) return false;
+        value = qFromLittleEndian<T>(reinterpret_cast<const uchar*>(p));
+        p += sizeof(T);
+        return true;
+    }
+
+    bool readFloat(float& value) {
+        quint32 bits;
+        if (!read(bits)) return false;
+        memcpy(&value, &bits, sizeof(value));
+        return true;
+    }
+
+    bool readDouble(double& value) {
+        quint64 bits;
+        if (!read(bits)) return false;
+        memcpy(&value, &bits, sizeof(value));
+        return true;
+    }
+
+    bool readHeader() {
+        quint32 magic = 0;
+        quint16 typeCount = 0;
+        double x = 0, y = 0, w = 0, h = 0;
+        if (!read(magic) || magic != ItemClipboard::kMagic) return false;
+        if (!read(version) || version < 1 || version > ItemClipboard::kVersion) return false;
+        if (!read(typeCount) || !read(itemCount)) return false;
+        if (!readDouble(x) || !readDouble(y) || !readDouble(w) || !readDouble(h)) return false;
+        itemBounds = QRectF(x, y, w, h);
+
+        for (quint16 i = 0; i < typeCount; ++i) {
+            quint16 len = 0;
+            if (!read(len) || end - p < len) return false;
+            types << QString::fromUtf8(p, len);
+            p += len;
+        }
+        return true;
+    }
+
+    QByteArray payload;     // 持有隐式共享引用，保证读取期间数据有效
+    const char* p;
+    const char* end;
+    bool valid = false;
+    quint32 itemCount = 0;
+    quint32 itemsRead = 0;
+    QRectF itemBounds;
+    QStringList types;
+    quint16 version = 0;
+    QRgb lastArgb = 0;
+    PaletteColor lastColorIndex;
+    bool hasLastColor = false;
+    QHash<quint16, quint8> typeSlots;
+    QByteArray lastFont;
+    QFont lastParsedFont;
+};
+
+// 按记录从对象池取出图元并加入场景，按插入顺序叠放在最上层
+BaseCustomItem* insertRecord(QGraphicsScene* scene, const ItemRecord& record, const QPointF& offset) {
+    BaseCustomItem* item = ItemPool::GetInstance().acquire(record.type);
+    if (!item) return nullptr;
+    item->setItemData(record.data);
+    item->setPos(record.pos + offset);
+    item->setZValue(ZOrderKeys::nextTop(scene));
+    scene->addItem(item);
+    return item;
+}
+
+// 逐条插入记录并还原组合：成员先作为顶层图元插入，全部插入后再收入各自的组合
+class RecordInserter {
+public:
+    RecordInserter(QGraphicsScene* scene, const QPointF& offset) : scene(scene), offset(offset) {}
+
+    void insert(const ItemRecord& record) {
+        BaseCustomItem* item = insertRecord(scene, record, offset);
+        if (!item) return;
+        const bool isGroup = item->objectType() == "Group";
+        if (isGroup && record.id) groups.insert(record.id, inserted.size());
+        inserted.push_back(Entry{item, record.parent, isGroup});
+    }
+
+    // 收入组合成员，返回顶层图元（插入顺序）；调用方负责暂停索引
+    QList<BaseCustomItem*> finish() {
+        // 组合必须先于成员出现，损坏的数据不会让组合收入自身或祖先
+        std::vector<size_t> owner(inserted.size(), kTopLevel);
+        std::vector<int> memberCount(inserted.size(), 0);
+        for (size_t i = 0; i < inserted.size(); ++i) {
+            auto group = inserted[i].parent ? groups.constFind(inserted[i].parent) : groups.constEnd();
+            if (group != groups.constEnd() && group.value() < i) owner[i] = group.value();
+        }
+        // 没有成员的组合不可见也无法操作，丢弃；内层组合在后，倒序统计
+        for (size_t i = inserted.size(); i-- > 0; ) {
+            if (inserted[i].isGroup && memberCount[i] == 0) {
+                scene->removeItem(inserted[i].item);
+                ItemPool::GetInstance().release(inserted[i].item);
+                inserted[i].item = nullptr;
+            } else if (owner[i] != kTopLevel) {
+                ++memberCount[owner[i]];
+            }
+        }
+
+        std::vector<QList<BaseCustomItem*>> members(inserted.size());
+        QList<BaseCustomItem*> topLevel;
+        for (size_t i = 0; i < inserted.size(); ++i) {
+            if (!inserted[i].item) continue;
+            if (owner[i] != kTopLevel) members[owner[i]] << inserted[i].item;
+            else topLevel << inserted[i].item;
+        }
+        // 倒序收入，外层收入时内层外框已经确定
+        for (size_t i = inserted.size(); i-- > 0; ) {
+            if (!members[i].isEmpty()) static_cast<GroupItem*>(inserted[i].item)->adopt(members[i]);
+        }
+        inserted.clear();
+        groups.clear();
+        return topLevel;
+    }
+
+private:
+    struct Entry {
+        BaseCustomItem* item;
+        quint64 parent;
+        bool isGroup;
+    };
+
+    static constexpr size_t kTopLevel = size_t(-1);
+
+    QGraphicsScene* scene;
+    QPointF offset;
+    std::vector<Entry> inserted;
+    QHash<quint64, size_t> groups;  // 组合记录 id -> inserted 下标
+};
+
+// 将记录批量插入场景，插入期间暂停索引；返回顶层图元
+QList<BaseCustomItem*> insertRecords(QGraphicsScene* scene, const std::vector<ItemRecord>& records, const QPointF& offset) {
+    SceneIndexSuspender suspender(scene, int(records.size()));
+    RecordInserter inserter(scene, offset);
+    for (const ItemRecord& record : records) {
+        inserter.insert(record);
+    }
+    return inserter.finish();
+}
+
+// 粘贴的撤销步骤，入栈时图元已在场景中，首次 redo 不重复插入
+class PasteItemsUndo : public QUndoCommand {
+public:
+    PasteItemsUndo(QGraphicsScene* scene, const QList<BaseCustomItem*>& items)
+        : scene(scene), items(items) {
+        setText(QString("粘贴 %1 个图元").arg(items.size()));
+    }
+
+    ~PasteItemsUndo() override {
+        // 撤销后图元归本命令所有，释放回对象池
+        if (!inScene) {
+            for (BaseCustomItem* item : items) {
+                ItemPool::GetInstance().release(item);
+            }
+        }
+    }
+
+    void undo() override {
+        if (!scene) return;
+        SceneIndexSuspender suspender(scene, items.size());
+        for (BaseCustomItem* item : items) {
+            scene->removeItem(item);
+        }
+        inScene = false;
+    }
+
+    void redo() override {
+        if (firstRedo) {
+            firstRedo = false;
+            return;
+        }
+        if (!scene) return;
+        SceneIndexSuspender suspender(scene, items.size());
+        for (BaseCustomItem* item : items) {
+            scene->addItem(item);
+        }
+        inScene = true;
+    }
+
+private:
+    QPointer<QGraphicsScene> scene;
+    QList<BaseCustomItem*> items;
+    bool inScene = true;
+    bool firstRedo = true;
+};
+
+// 剪切的撤销命令：移出场景的图元由本命令持有，撤销时直接放回，不重新分配
+class CutItemsUndo : public QUndoCommand {
+public:
+    CutItemsUndo(QGraphicsScene* scene, const QList<BaseCustomItem*>& items)
+        : scene(scene), items(items) {
+        setText(QString("剪切 %1 个图元").arg(items.size()));
+    }
+
+    ~CutItemsUndo() override {
+        // 未撤销时图元归本命令所有，释放回对象池
+        if (!inScene) {
+            for (BaseCustomItem* item : items) {
+                ItemPool::GetInstance().release(item);
+            }
+        }
+    }
+
+    void undo() override {
+        if (!scene || inScene) return;
+        SceneIndexSuspender suspender(scene, items.size());
+        for (BaseCustomItem* item : items) {
+            scene->addItem(item);
+        }
+        inScene = true;
+    }
+
+    void redo() override {
+        if (!scene || !inScene) return;
+        // 先整体取消选择，只发出一次选择变化通知
+        scene->clearSelection();
+        SceneIndexSuspender suspender(scene, items.size());
+        for (BaseCustomItem* item : items) {
+            scene->removeItem(item);
+        }
+        inScene = false;
+    }
+
+private:
+    QPointer<QGraphicsScene> scene;
+    QList<BaseCustomItem*> items;
+    bool inScene = true;
+};
+
+// 大数据量粘贴：工作线程解码成批，GUI线程按帧预算逐批插入，先显示占位外框，完成后整体作为一步撤销
+class AsyncPasteJob : public QObject {
+public:
+    AsyncPasteJob(QGraphicsScene* scene, const QByteArray& payload, int count, const QRectF& bounds, const QPointF& offset)
+        : QObject(scene), scene(scene), inserter(scene, offset) {
+        placeholder = new QGraphicsRectItem(bounds.translated(offset));
+        placeholder->setPen(QPen(Qt::gray, 0, Qt::DashLine));
+        placeholder->setZValue(std::numeric_limits<qreal>::max());
+        scene->addItem(placeholder);
+
+        suspender.reset(new SceneIndexSuspender(scene, count));
+        worker = std::thread(&AsyncPasteJob::decode, this, payload);
+        connect(&timer, &QTimer::timeout, this, [this]() { insertChunk(); });
+        timer.start(0);
+    }
+
+    ~AsyncPasteJob() override {
+        queue.cancel();
+        if (worker.joinable()) worker.join();
+    }
+
+private:
+    static const size_t kBatchSize = 4096;
+    static const int kFrameBudgetMs = 8;
+
+    // 工作线程，payload 与剪贴板共享同一份数据
+    void decode(QByteArray payload) {
+        ItemPayloadReader reader(payload);
+        std::vector<ItemRecord> batch;
+        batch.reserve(kBatchSize);
+        ItemRecord record;
+        while (!queue.isCancelled() && reader.next(record)) {
+            batch.push_back(record);
+            if (batch.size() >= kBatchSize) {
+                if (!queue.push(std::move(batch))) break;
+                batch = std::vector<ItemRecord>();
+                batch.reserve(kBatchSize);
+            }
+        }
+        if (!batch.empty()) queue.push(std::move(batch));
+        queue.close();
+    }
+
+    void insertChunk() {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        while (elapsed.elapsed() < kFrameBudgetMs) {
+            if (currentIndex >= current.size()) {
+                if (!queue.tryPop(current)) {
+                    if (queue.isDrained()) finish();
+                    return;
+                }
+                currentIndex = 0;
+            }
+            inserter.insert(current[currentIndex++]);
+        }
+    }
+
+    void finish() {
+        timer.stop();
+        delete placeholder;
+        placeholder = nullptr;
+        const QList<BaseCustomItem*> items = inserter.finish();
+        suspender.reset();
+        if (!items.isEmpty()) {
+            undoStackFor(scene)->push(new PasteItemsUndo(scene, items));
+            NotificationCenter::GetInstance().count("paste", "已粘贴 %1 个图元", items.size());
+        }
+        deleteLater();
+    }
+
+    QGraphicsScene* scene;
+    RecordInserter inserter;
+    QGraphicsRectItem* placeholder = nullptr;
+    std::unique_ptr<SceneIndexSuspender> suspender;
+    std::thread worker;
+    QTimer timer;
+    BatchQueue<std::vector<ItemRecord>> queue;
+    std::vector<ItemRecord> current;
+    size_t currentIndex = 0;
+};
+
+//*******************************************************************************************/
+// 快照与导出
+//*******************************************************************************************/
+// 快照中的单个图元，数据与场景中的图元写时复制共享
+struct ItemSnapshot {
+    quint64 id;
+    quint64 revision;
+    quint64 parent = 0;     // 所属组合的 id
+    QString type;
+    QPointF pos;
+    QSharedDataPointer<ItemData> data;
+
+    // 场景中的外框，含旋转；组合没有自己的尺寸，为空
+    QRectF sceneRect() const {
+        if (!data->size.isValid()) return QRectF();
+        const QRectF rect(QPointF(0, 0), data->size);
+        return data->transform().mapRect(rect).translated(pos);
+    }
+};
+
+using SceneSnapshot = std::vector<ItemSnapshot>;
+
+void appendSnapshot(SceneSnapshot& snapshot, BaseCustomItem* item, BaseCustomItem* parent) {
+    ItemSnapshot entry;
+    entry.id = item->id();
+    // 组合移动会改变子图元的场景位置，版本号计入父项（两者都只增不减）
+    entry.revision = item->revision();
+    if (parent) {
+        entry.revision += parent->revision();
+        entry.parent = parent->id();
+    }
+    entry.type = item->objectType();
+    entry.pos = item->positionInScene();
+    entry.data = item->sharedData();
+    snapshot.push_back(entry);
+
+    // 组合的子项按叠放次序返回，Qt 只在子项变化后重新排序
+    for (QGraphicsItem* child : item->childItems()) {
+        if (BaseCustomItem* baseChild = dynamic_cast<BaseCustomItem*>(child)) appendSnapshot(snapshot, baseChild, item);
+    }
+}
+
+// GUI线程调用，按绘制顺序（自底向上）收集，组合先于其成员，只复制指针与引用计数
+// 顶层次序取自场景维护的叠放次序，不经过 items() 收集排序
+SceneSnapshot takeSnapshot(QGraphicsScene* scene) {
+    SceneSnapshot snapshot;
+    SceneItemList* list = SceneItemList::find(scene);
+    if (!list) return snapshot;
+    snapshot.reserve(size_t(list->size()));
+    for (const auto& entry : list->stack()) {
+        appendSnapshot(snapshot, entry.second, nullptr);
+    }
+    return snapshot;
+}
+
+// 分块TIFF写入器：未压缩RGB，图块按行优先顺序依次写入，偏移量预先算出，无需缓存整幅图像
+// 输出不超过4GB时写经典TIFF（32位偏移），否则写BigTIFF（64位偏移）
+class TiledTiffWriter {
+public:
+    bool open(const QString& path, int width, int height, int tileSize, int dpi) {
+        this->width = width;
+        this->height = height;
+        this->tileSize = tileSize;
+        tilesAcross = (width + tileSize - 1) / tileSize;
+        tilesDown = (height + tileSize - 1) / tileSize;
+        tileBytes = quint32(tileSize) * quint32(tileSize) * 3;
+        tilesWritten = 0;
+
+        const quint32 tileCount = quint32(tilesAcross * tilesDown);
+        // 头部与目录不足 4KB，按图块数据与偏移表估算
+        big = quint64(tileCount) * (tileBytes + 8) + 4096 > 0xffffffffULL;
+        const quint16 entryCount = 14;
+        const quint64 ifdOffset = big ? 16 : 8;
+        const quint64 extraOffset = big ? ifdOffset + 8 + entryCount * 20 + 8 : ifdOffset + 2 + entryCount * 12 + 4;
+
+        // 放不进目录项值域的数据依次放在目录之后，按字对齐
+        QByteArray extra;
+        auto valueField = [this, &extra, extraOffset](const QByteArray& values) {
+            if (values.size() <= fieldSize()) return inlineField(values);
+            const quint64 offset = extraOffset + quint64(extra.size());
+            extra.append(values);
+            if (extra.size() % 2) extra.append('\0');
+            return pointerField(offset);
+        };
+        QByteArray bits, xRes, yRes;
+        for (int i = 0; i < 3; ++i) put<quint16>(bits, 8);
+        put<quint32>(xRes, quint32(dpi));
+        put<quint32>(xRes, 1);
+        put<quint32>(yRes, quint32(dpi));
+        put<quint32>(yRes, 1);
+        const QByteArray bitsField = valueField(bits);
+        const QByteArray xResField = valueField(xRes);
+        const QByteArray yResField = valueField(yRes);
+
+        const int offsetBytes = big ? 8 : 4;
+        const quint64 offsetsOffset = extraOffset + quint64(extra.size());
+        const quint64 countsOffset = offsetsOffset + quint64(offsetBytes) * tileCount;
+        const quint64 dataOffset = countsOffset + 4ULL * tileCount;
+
+        file.setFileName(path);
+        if (!file.open(QIODevice::WriteOnly)) return false;
+
+        QByteArray head;
+        head.append("II", 2);
+        if (big) {
+            put<quint16>(head, 43);
+            put<quint16>(head, 8);  // 偏移字节数
+            put<quint16>(head, 0);
+            put<quint64>(head, ifdOffset);
+            put<quint64>(head, entryCount);
+        } else {
+            put<quint16>(head, 42);
+            put<quint32>(head, quint32(ifdOffset));
+            put<quint16>(head, entryCount);
+        }
+
+        const quint16 offsetType = big ? kLong8 : kLong;
+        putEntry(head, 256, kLong, 1, scalarField(kLong, quint32(width)));          // ImageWidth
+        putEntry(head, 257, kLong, 1, scalarField(kLong, quint32(height)));         // ImageLength
+        putEntry(head, 258, kShort, 3, bitsField);                                  // BitsPerSample
+        putEntry(head, 259, kShort, 1, scalarField(kShort, 1));                     // Compression: none
+        putEntry(head, 262, kShort, 1, scalarField(kShort, 2));                     // Photometric: RGB
+        putEntry(head, 277, kShort, 1, scalarField(kShort, 3));                     // SamplesPerPixel
+        putEntry(head, 282, kRational, 1, xResField);                               // XResolution
+        putEntry(head, 283, kRational, 1, yResField);                               // YResolution
+        putEntry(head, 284, kShort, 1, scalarField(kShort, 1));                     // PlanarConfiguration
+        putEntry(head, 296, kShort, 1, scalarField(kShort, 2));                     // ResolutionUnit: inch
+        putEntry(head, 322, kLong, 1, scalarField(kLong, quint32(tileSize)));       // TileWidth
+        putEntry(head, 323, kLong, 1, scalarField(kLong, quint32(tileSize)));       // TileLength
+        putEntry(head, 324, offsetType, tileCount,                                  // TileOffsets
+                 tileCount == 1 ? scalarField(offsetType, dataOffset) : pointerField(offsetsOffset));
+        putEntry(head, 325, kLong, tileCount,                                       // TileByteCounts
+                 tileCount == 1 ? scalarField(kLong, tileBytes) : pointerField(countsOffset));
+        head.append(pointerField(0));   // 无下一个IFD
+        head.append(extra);
+        if (file.write(head) != head.size()) return false;
+
+        // 偏移表与字节数表按块写出，避免为超大图像一次分配
+        QByteArray table;
+        for (int pass = 0; pass < 2; ++pass) {
+            for (quint32 i = 0; i < tileCount; ++i) {
+                if (pass == 1) put<quint32>(table, tileBytes);
+                else if (big) put<quint64>(table, dataOffset + quint64(i) * tileBytes);
+                else put<quint32>(table, quint32(dataOffset + quint64(i) * tileBytes));
+                if (table.size() >= 65536) {
+                    if (file.write(table) != table.size()) return false;
+                    table.clear();
+                }
+            }
+        }
+        return file.write(table) == table.size();
+    }
+
+    int tileCount() const { return tilesAcross * tilesDown; }
+
+    // 第 index 个图块对应的像素区域（行优先）
+    QRect tileRect(int index) const {
+        return QRect((index % tilesAcross) * tileSize, (index / tilesAcross) * tileSize, tileSize, tileSize);
+    }
+
+    // 图块需按顺序写入，tile 为 tileSize x tileSize 的 RGB888 图像
+    bool writeTile(const QImage& tile) {
+        const int rowBytes = tileSize * 3;
+        for (int y = 0; y < tileSize; ++y) {
+            if (file.write(reinterpret_cast<const char*>(tile.constScanLine(y)), rowBytes) != rowBytes) return false;
+        }
+        ++tilesWritten;
+        return true;
+    }
+
+    bool close() {
+        file.close();
+        return tilesWritten == tileCount() && file.error() == QFileDevice::NoError;
+    }
+
+private:
+    static const quint16 kShort = 3;
+    static const quint16 kLong = 4;
+    static const quint16 kRational = 5;
+    static const quint16 kLong8 = 16;   // 仅BigTIFF
+
+    template <typename T>
+    static void put(QByteArray& out, T value) {
+        value = qToLittleEndian(value);
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    // 目录项值域：经典TIFF 4 字节，BigTIFF 8 字节
+    int fieldSize() const { return big ? 8 : 4; }
+
+    // 值左对齐存放在值域中
+    QByteArray inlineField(const QByteArray& values) const {
+        QByteArray field = values;
+        field.append(fieldSize() - values.size(), '\0');
+        return field;
+    }
+
+    QByteArray scalarField(quint16 type, quint64 value) const {
+        QByteArray values;
+        if (type == kShort) put<quint16>(values, quint16(value));
+        else if (type == kLong) put<quint32>(values, quint32(value));
+        else put<quint64>(values, value);
+        return inlineField(values);
+    }
+
+    QByteArray pointerField(quint64 offset) const {
+        QByteArray field;
+        if (big) put<quint64>(field, offset);
+        else put<quint32>(field, quint32(offset));
+        return field;
+    }
+
+    void putEntry(QByteArray& out, quint16 tag, quint16 type, quint64 count, const QByteArray& field) const {
+        put<quint16>(out, tag);
+        put<quint16>(out, type);
+        if (big) put<quint64>(out, count);
+        else put<quint32>(out, quint32(count));
+        out.append(field);
+    }
+
+    QFile file;
+    int width = 0;
+    int height = 0;
+    int tileSize = 0;
+    int tilesAcross = 0;
+    int tilesDown = 0;
+    quint32 tileBytes = 0;
+    int tilesWritten = 0;
+    bool big = false;
+};
+
+// 场景分块并行导出：按快照在线程池中并行绘制图块，按顺序流式写入
+// 同时在内存中的图块数不超过 2 倍线程数，峰值内存与输出尺寸无关
+class TiledSceneExporter {
+public:
+    static const int kTileSize = 256;
+
+    // 在GUI线程调用，收集绘制函数
+    explicit TiledSceneExporter(SceneSnapshot snapshot) : snapshot(std::move(snapshot)) {
+        for (const ItemSnapshot& entry : this->snapshot) {
+            if (!painters.contains(entry.type)) {
+                painters.insert(entry.type, ItemFactory::GetInstance().painter(entry.type));
+            }
+        }
+    }
+
+    // 可在任意线程调用
+    bool exportTiff(const QString& path, int dpi) {
+        QRectF sceneRect;
+        for (const ItemSnapshot& entry : snapshot) {
+            sceneRect |= entry.sceneRect();
+        }
+        if (sceneRect.isEmpty()) return false;
+
+        const qreal scale = dpi / 96.0;
+        const int width = qCeil(sceneRect.width() * scale);
+        const int height = qCeil(sceneRect.height() * scale);
+
+        TiledTiffWriter writer;
+        if (!writer.open(path, width, height, kTileSize, dpi)) return false;
+
+        // 按图块行分桶，桶内保持绘制顺序
+        const qreal tileScene = kTileSize / scale;
+        const int tilesDown = (height + kTileSize - 1) / kTileSize;
+        std::vector<std::vector<quint32>> rows(tilesDown);
+        for (quint32 i = 0; i < snapshot.size(); ++i) {
+            const QRectF rect = snapshot[i].sceneRect();
+            if (rect.isNull()) continue;
+            int first = qMax(0, int((rect.top() - sceneRect.top()) / tileScene));
+            int last = qMin(tilesDown - 1, int((rect.bottom() - sceneRect.top()) / tileScene));
+            for (int row = first; row <= last; ++row) {
+                rows[row].push_back(i);
+            }
+        }
+
+        struct Tile {
+            int index;
+            QImage image;
+        };
+
+        const int chunk = qMax(1, QThread::idealThreadCount() * 2);
+        const int tilesAcross = (width + kTileSize - 1) / kTileSize;
+        for (int first = 0; first < writer.tileCount(); first += chunk) {
+            std::vector<Tile> tiles;
+            for (int i = first; i < qMin(first + chunk, writer.tileCount()); ++i) {
+                Tile tile;
+                tile.index = i;
+                tiles.push_back(tile);
+            }
+
+            QtConcurrent::blockingMap(tiles, [&](Tile& tile) {
+                QRect pixels = writer.tileRect(tile.index);
+                QRectF area(sceneRect.left() + pixels.x() / scale, sceneRect.top() + pixels.y() / scale,
+                            tileScene, tileScene);
+                tile.image = renderTile(area, scale, rows[tile.index / tilesAcross]);
+            });
+
+            for (const Tile& tile : tiles) {
+                if (!writer.writeTile(tile.image)) return false;
+            }
+        }
+        return writer.close();
+    }
+
+private:
+    QImage renderTile(const QRectF& area, qreal scale, const std::vector<quint32>& candidates) const {
+        QImage image(kTileSize, kTileSize, QImage::Format_RGB888);
+        image.fill(Qt::white);
+
+        QPainter painter(&image);
+        painter.scale(scale, scale);
+        painter.translate(-area.topLeft());
+        for (quint32 i : candidates) {
+            const ItemSnapshot& entry = snapshot[i];
+            if (!area.intersects(entry.sceneRect())) continue;
+            auto paint = painters.constFind(entry.type);
+            if (paint == painters.constEnd() || !paint.value()) continue;
+            painter.save();
+            painter.translate(entry.pos);
+            if (entry.data->rotation != 0) painter.setTransform(entry.data->transform(), true);
+            paint.value()(&painter, *entry.data);
+            painter.restore();
+        }
+        return image;
+    }
+
+    SceneSnapshot snapshot;
+    QHash<QString, ItemFactory::Painter> painters;
+};
+
+
+//*******************************************************************************************/
+// 协作调度
+//*******************************************************************************************/
+// 帧预算截止时间，任务在循环中定期检查
+class FrameDeadline {
+public:
+    explicit FrameDeadline(qint64 budgetMs) : budgetMs(budgetMs) {
+        clock.start();
+    }
+
+    bool expired() const {
+        return clock.elapsed() >= budgetMs;
+    }
+
+private:
+    QElapsedTimer clock;
+    qint64 budgetMs;
+};
+
+// 可恢复的长任务：GUI线程上分片执行，每次 step 在截止前返回
+// QGraphicsItem 非线程安全，需要改动图元的批量命令都以此方式编写
+class ResumableTask {
+public:
+    virtual ~ResumableTask() = default;
+
+    // 返回 false 表示已完成
+    virtual bool step(const FrameDeadline& deadline) = 0;
+
+    virtual QString name() const { return QString(); }
+    // 0 ~ 100
+    virtual int progress() const { return 0; }
+    // 被取消时调用，用于清理
+    virtual void cancelled() {}
+};
+
+// 协作调度器：每轮事件循环最多占用 sliceBudgetMs 毫秒，按优先级权重分配给各任务，
+// 低优先级任务也能获得份额，不会饿死
+class CooperativeScheduler {
+public:
+    enum Priority { Low = 1, Normal = 2, High = 4 };   // 数值即权重
+    using TaskId = quint64;
+    using ProgressCallback = std::function<void(const QString& name, int percent)>;
+
+    // 单例
+    static CooperativeScheduler& GetInstance() {
+        static CooperativeScheduler scheduler;
+        return scheduler;
+    }
+
+    TaskId submit(std::shared_ptr<ResumableTask> task, Priority priority = Normal) {
+        Entry entry;
+        entry.id = ++lastId;
+        entry.priority = priority;
+        entry.task = std::move(task);
+        entries.push_back(entry);
+        if (!timer.isActive()) timer.start(0);
+        return entry.id;
+    }
+
+    void cancel(TaskId id) {
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->id == id) {
+                std::shared_ptr<ResumableTask> task = it->task;
+                entries.erase(it);
+                task->cancelled();
+                return;
+            }
+        }
+    }
+
+    void cancelAll() {
+        std::vector<Entry> pending;
+        pending.swap(entries);
+        for (const Entry& entry : pending) entry.task->cancelled();
+    }
+
+    bool isIdle() const { return entries.empty(); }
+
+    void setSliceBudget(int ms) { sliceBudgetMs = ms; }
+    void setProgressCallback(ProgressCallback callback) { onProgress = std::move(callback); }
+
+private:
+    struct Entry {
+        TaskId id;
+        Priority priority;
+        std::shared_ptr<ResumableTask> task;
+    };
+
+    CooperativeScheduler() {
+        QObject::connect(&timer, &QTimer::timeout, [this]() { runSlice(); });
+    }
+
+    void runSlice() {
+        int totalWeight = 0;
+        for (const Entry& entry : entries) totalWeight += entry.priority;
+
+        // 复制一份，任务执行中可能提交或取消其他任务
+        std::vector<Entry> running = entries;
+        for (const Entry& entry : running) {
+            if (!contains(entry.id)) continue;
+            qint64 share = qMax<qint64>(1, sliceBudgetMs * entry.priority / qMax(1, totalWeight));
+            bool more = entry.task->step(FrameDeadline(share));
+            if (onProgress) onProgress(entry.task->name(), more ? entry.task->progress() : 100);
+            if (!more) remove(entry.id);
+        }
+        if (entries.empty()) timer.stop();
+    }
+
+    bool contains(TaskId id) const {
+        for (const Entry& entry : entries) {
+            if (entry.id == id) return true;
+        }
+        return false;
+    }
+
+    void remove(TaskId id) {
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->id == id) {
+                entries.erase(it);
+                return;
+            }
+        }
+    }
+
+    std::vector<Entry> entries;
+    QTimer timer;
+    TaskId lastId = 0;
+    int sliceBudgetMs = 8;
+    ProgressCallback onProgress;
+};
+
+// 对一组图元逐个执行操作的分片任务，执行期间暂停场景索引
+// 图元只会经对象池回收而不会在任务期间被释放，执行前检查其是否仍在原场景中
+class ItemBatchTask : public ResumableTask {
+public:
+    using Operation = std::function<void(BaseCustomItem*)>;
+    using Finished = std::function<void()>;
+
+    ItemBatchTask(QGraphicsScene* scene, const QList<BaseCustomItem*>& items, const QString& name, Operation operation)
+        : scene(scene), items(items), taskName(name), operation(std::move(operation)) {}
+
+    // 完成或被取消后调用一次，供调用方提交撤销命令
+    void setFinished(Finished callback) {
+        finished = std::move(callback);
+    }
+
+    bool step(const FrameDeadline& deadline) override {
+        if (!scene) {
+            finish();
+            return false;
+        }
+        if (!suspender) suspender.reset(new SceneIndexSuspender(scene, items.size()));
+
+        while (next < items.size()) {
+            BaseCustomItem* item = items[next++];
+            if (item->scene() == scene) operation(item);
+            // 每处理一批检查一次时间
+            if ((next & 0xff) == 0 && deadline.expired()) return true;
+        }
+        finish();
+        return false;
+    }
+
+    QString name() const override { return taskName; }
+
+    int progress() const override {
+        return items.isEmpty() ? 100 : int(qint64(next) * 100 / items.size());
+    }
+
+    void cancelled() override {
+        finish();
+    }
+
+private:
+    void finish() {
+        suspender.reset();
+        if (!finished) return;
+        Finished callback = std::move(finished);
+        finished = nullptr;
+        callback();
+    }
+
+    QPointer<QGraphicsScene> scene;
+    QList<BaseCustomItem*> items;
+    QString taskName;
+    Operation operation;
+    Finished finished;
+    int next = 0;
+    std::unique_ptr<SceneIndexSuspender> suspender;
+};
+
+
+//*******************************************************************************************/
+// 批量变换
+//*******************************************************************************************/
+// 批量仿射变换：图元中心与尺寸收集到分量数组（SoA），向量化计算后在暂停索引期间一次性写回
+// 图元绕自身中心旋转，变换原点始终设为尺寸中心，因此 pos + size/2 即为视觉中心
+// 中心按场景坐标计算，组合内的图元（组合本身没有尺寸，调用方展开为成员）写回时换算到组合坐标
+class BulkTransformEngine {
+public:
+    explicit BulkTransformEngine(const QList<BaseCustomItem*>& items) : items(items) {
+        const size_t n = size_t(items.size());
+        cx.resize(n);
+        cy.resize(n);
+        w.resize(n);
+        h.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            const QSizeF size = items[int(i)]->itemData().size;
+            const QPointF pos = items[int(i)]->positionInScene();
+            w[i] = size.width();
+            h[i] = size.height();
+            cx[i] = pos.x() + w[i] * 0.5;
+            cy[i] = pos.y() + h[i] * 0.5;
+        }
+    }
+
+    // 所有图元中心的包围盒中心，作为旋转、缩放的基准点
+    QPointF pivot() const {
+        if (cx.empty()) return QPointF();
+        auto xs = std::minmax_element(cx.begin(), cx.end());
+        auto ys = std::minmax_element(cy.begin(), cy.end());
+        return QPointF((*xs.first + *xs.second) * 0.5, (*ys.first + *ys.second) * 0.5);
+    }
+
+    // 中心点做仿射变换，约定与 QTransform::map 一致
+    void mapCenters(const QTransform& t) {
+        mapPoints(cx.data(), cy.data(), cx.size(), t);
+    }
+
+    void scaleSizes(double factor) {
+        scale(w.data(), w.size(), factor);
+        scale(h.data(), h.size(), factor);
+    }
+
+    // 写回场景；已不在该场景中的图元跳过
+    void scatter(QGraphicsScene* scene, bool sizeChanged, qreal rotationDelta) {
+        SceneIndexSuspender suspender(scene, int(cx.size()));
+        for (size_t i = 0; i < cx.size(); ++i) {
+            BaseCustomItem* item = items[int(i)];
+            if (item->scene() != scene) continue;
+            const QSizeF size(w[i], h[i]);
+            if (sizeChanged) item->setSize(size);
+            item->setItemRotation(item->itemData().rotation + rotationDelta, QPointF(size.width() * 0.5, size.height() * 0.5));
+            const QPointF topLeft(cx[i] - size.width() * 0.5, cy[i] - size.height() * 0.5);
+            item->setPos(item->parentItem() ? item->parentItem()->mapFromScene(topLeft) : topLeft);
+        }
+    }
+
+private:
+    static void mapPoints(double* x, double* y, size_t n, const QTransform& t) {
+        const double m11 = t.m11(), m12 = t.m12(), m21 = t.m21(), m22 = t.m22(), dx = t.dx(), dy = t.dy();
+        size_t i = 0;
+#ifdef CONTEXT_MENU_SSE2
+        const __m128d a = _mm_set1_pd(m11), b = _mm_set1_pd(m12);
+        const __m128d c = _mm_set1_pd(m21), d = _mm_set1_pd(m22);
+        const __m128d tx = _mm_set1_pd(dx), ty = _mm_set1_pd(dy);
+        for (; i + 2 <= n; i += 2) {
+            const __m128d vx = _mm_loadu_pd(x + i);
+            const __m128d vy = _mm_loadu_pd(y + i);
+            _mm_storeu_pd(x + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, a), _mm_mul_pd(vy, c)), tx));
+            _mm_storeu_pd(y + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, b), _mm_mul_pd(vy, d)), ty));
+        }
+#endif
+        // 标量实现，同时处理向量化剩余的尾部
+        for (; i < n; ++i) {
+            const double vx = x[i], vy = y[i];
+            x[i] = m11 * vx + m21 * vy + dx;
+            y[i] = m12 * vx + m22 * vy + dy;
+        }
+    }
+
+    static void scale(double* v, size_t n, double factor) {
+        size_t i = 0;
+#ifdef CONTEXT_MENU_SSE2
+        const __m128d f = _mm_set1_pd(factor);
+        for (; i + 2 <= n; i += 2) {
+            _mm_storeu_pd(v + i, _mm_mul_pd(_mm_loadu_pd(v + i), f));
+        }
+#endif
+        for (; i < n; ++i) {
+            v[i] *= factor;
+        }
+    }
+
+    QList<BaseCustomItem*> items;
+    std::vector<double> cx, cy, w, h;
+};
+
+// 批量变换的撤销命令：只记录变换参数，撤销时对同一组图元应用逆变换
+// 图元只会经对象池回收而不会被释放，写回时检查其是否仍在原场景中
+class BulkTransformUndo : public QUndoCommand {
+public:
+    BulkTransformUndo(QGraphicsScene* scene, const QList<BaseCustomItem*>& items, const QString& text,
+                      const QTransform& transform, qreal sizeFactor, qreal rotationDelta)
+        : scene(scene), items(items), transform(transform), sizeFactor(sizeFactor), rotationDelta(rotationDelta) {
+        setText(text);
+    }
+
+    void undo() override {
+        apply(transform.inverted(), 1.0 / sizeFactor, -rotationDelta);
+    }
+
+    void redo() override {
+        apply(transform, sizeFactor, rotationDelta);
+    }
+
+private:
+    void apply(const QTransform& t, qreal factor, qreal rotation) {
+        if (!scene) return;
+        BulkTransformEngine engine(items);
+        engine.mapCenters(t);
+        if (factor != 1.0) engine.scaleSizes(factor);
+        engine.scatter(scene, factor != 1.0, rotation);
+    }
+
+    QPointer<QGraphicsScene> scene;
+    QList<BaseCustomItem*> items;
+    QTransform transform;
+    qreal sizeFactor;
+    qreal rotationDelta;
+};
+
+
+//*******************************************************************************************/
+// 自动布局
+//*******************************************************************************************/
+// 版式布局：GUI线程取几何快照，工作线程计算位置，结果作为一次可撤销的批量修改写回
+// 每个场景保留上次布局的输入与结果；再次布局时与之比较，只重算受影响的部分
+struct LayoutItem {
+    quint64 id;
+    QSizeF size;
+    QPointF pos;
+};
+
+struct LayoutParams {
+    qreal width = 800;          // 网格、流式布局的可用宽度
+    qreal spacing = 10;
+    qreal guide = 50;           // 参考线间距
+    QPointF origin = QPointF(20, 20);
+
+    bool operator==(const LayoutParams& other) const {
+        return width == other.width && spacing == other.spacing && guide == other.guide && origin == other.origin;
+    }
+};
+
+// 一次布局的完整结果，不可变，可在线程间共享
+struct LayoutState {
+    enum Mode { Grid, Flow, Align };
+
+    Mode mode = Grid;
+    LayoutParams params;
+    std::vector<quint64> ids;
+    std::vector<QSizeF> sizes;
+    std::vector<QPointF> positions;     // 布局后的位置
+    std::vector<char> rowStarts;        // 流式布局：该图元是否位于行首
+    QSizeF cell;                        // 网格布局：单元尺寸
+};
+
+class AutoLayout {
+public:
+    // previous 为同一场景上次的布局结果，可为空；图元序列、模式或参数不同时全量计算
+    static std::shared_ptr<const LayoutState> compute(LayoutState::Mode mode, const LayoutParams& params,
+                                                      const std::vector<LayoutItem>& items,
+                                                      std::shared_ptr<const LayoutState> previous) {
+        std::shared_ptr<LayoutState> state = std::make_shared<LayoutState>();
+        state->mode = mode;
+        state->params = params;
+        state->ids.reserve(items.size());
+        state->sizes.reserve(items.size());
+        for (const LayoutItem& item : items) {
+            state->ids.push_back(item.id);
+            state->sizes.push_back(item.size);
+        }
+        state->positions.resize(items.size());
+
+        if (previous && (previous->mode != mode || !(previous->params == params) || previous->ids != state->ids)) {
+            previous.reset();
+        }
+        switch (mode) {
+        case LayoutState::Grid:
+            grid(*state, previous.get());
+            break;
+        case LayoutState::Flow:
+            flow(*state, previous.get());
+            break;
+        case LayoutState::Align:
+            align(*state, items, previous.get());
+            break;
+        }
+        return state;
+    }
+
+private:
+    static const size_t kChunk = 4096;
+
+    // 按块并行处理下标区间
+    template <typename F>
+    static void parallelFor(size_t count, F fn) {
+        std::vector<std::pair<size_t, size_t>> chunks;
+        for (size_t begin = 0; begin < count; begin += kChunk) {
+            chunks.emplace_back(begin, qMin(count, begin + kChunk));
+        }
+        QtConcurrent::blockingMap(chunks, [&fn](const std::pair<size_t, size_t>& chunk) {
+            for (size_t i = chunk.first; i < chunk.second; ++i) fn(i);
+        });
+    }
+
+    // 网格：单元取最大图元尺寸，位置只取决于序号与单元尺寸；单元不变时沿用上次结果
+    static void grid(LayoutState& state, const LayoutState* previous) {
+        const LayoutParams& p = state.params;
+        QSizeF cell;
+        for (const QSizeF& size : state.sizes) cell = cell.expandedTo(size);
+        cell += QSizeF(p.spacing, p.spacing);
+        state.cell = cell;
+
+        if (previous && previous->cell == cell) {
+            state.positions = previous->positions;
+            return;
+        }
+        const size_t columns = size_t(qMax(1, qFloor((p.width + p.spacing) / qMax<qreal>(cell.width(), 1))));
+        parallelFor(state.positions.size(), [&state, &p, cell, columns](size_t i) {
+            state.positions[i] = p.origin + QPointF(qreal(i % columns) * cell.width(), qreal(i / columns) * cell.height());
+        });
+    }
+
+    // 流式：按宽度换行，行高取行内最高图元
+    // 增量时从第一个尺寸变化的图元所在行开始重排，越过最后一个变化后，某行行首与上次一致即沿用其后的结果
+    static void flow(LayoutState& state, const LayoutState* previous) {
+        const LayoutParams& p = state.params;
+        const size_t n = state.sizes.size();
+        state.rowStarts.assign(n, 0);
+
+        size_t start = 0;
+        size_t lastChanged = n;
+        if (previous) {
+            size_t firstChanged = n;
+            for (size_t i = 0; i < n; ++i) {
+                if (state.sizes[i] != previous->sizes[i]) {
+                    if (firstChanged == n) firstChanged = i;
+                    lastChanged = i;
+                }
+            }
+            if (firstChanged == n) {
+                state.positions = previous->positions;
+                state.rowStarts = previous->rowStarts;
+                return;
+            }
+            start = firstChanged;
+            while (start > 0 && !previous->rowStarts[start]) --start;
+            std::copy(previous->positions.begin(), previous->positions.begin() + start, state.positions.begin());
+            std::copy(previous->rowStarts.begin(), previous->rowStarts.begin() + start, state.rowStarts.begin());
+        }
+
+        qreal x = p.origin.x();
+        qreal y = (previous && start < n) ? previous->positions[start].y() : p.origin.y();
+        qreal rowHeight = 0;
+        for (size_t i = start; i < n; ++i) {
+            const QSizeF& size = state.sizes[i];
+            bool newRow = i == start || (x > p.origin.x() && x + size.width() > p.origin.x() + p.width);
+            if (newRow && i != start) {
+                y += rowHeight + p.spacing;
+                x = p.origin.x();
+                rowHeight = 0;
+            }
+            state.rowStarts[i] = newRow;
+
+            if (newRow && previous && lastChanged < i && previous->rowStarts[i] && previous->positions[i].y() == y) {
+                std::copy(previous->positions.begin() + i, previous->positions.end(), state.positions.begin() + i);
+                std::copy(previous->rowStarts.begin() + i, previous->rowStarts.end(), state.rowStarts.begin() + i);
+                return;
+            }
+            state.positions[i] = QPointF(x, y);
+            x += size.width() + p.spacing;
+            rowHeight = qMax(rowHeight, size.height());
+        }
+    }
+
+    // 对齐参考线：左上角吸附到最近的参考线，各图元互不影响；增量时只处理位置或尺寸变化的图元
+    static void align(LayoutState& state, const std::vector<LayoutItem>& items, const LayoutState* previous) {
+        const LayoutParams& p = state.params;
+        std::vector<size_t> dirty;
+        if (previous) {
+            state.positions = previous->positions;
+            for (size_t i = 0; i < items.size(); ++i) {
+                if (items[i].pos != previous->positions[i] || items[i].size != previous->sizes[i]) dirty.push_back(i);
+            }
+        } else {
+            dirty.resize(items.size());
+            std::iota(dirty.begin(), dirty.end(), size_t(0));
+        }
+        auto snap = [&p](qreal value, qreal origin) {
+            return origin + qRound((value - origin) / p.guide) * p.guide;
+        };
+        parallelFor(dirty.size(), [&state, &items, &dirty, &p, &snap](size_t k) {
+            const QPointF& pos = items[dirty[k]].pos;
+            state.positions[dirty[k]] = QPointF(snap(pos.x(), p.origin.x()), snap(pos.y(), p.origin.y()));
+        });
+    }
+};
+
+// 场景上次的布局结果，作为场景子对象保存
+class LayoutSession : public QObject {
+public:
+    static LayoutSession* of(QGraphicsScene* scene) {
+        // 未声明 Q_OBJECT，不能用 findChild 按类型查找
+        for (QObject* child : scene->children()) {
+            if (LayoutSession* session = dynamic_cast<LayoutSession*>(child)) return session;
+        }
+        LayoutSession* session = new LayoutSession();
+        session->setParent(scene);
+        return session;
+    }
+
+    std::shared_ptr<const LayoutState> state;
+};
+
+// 版式布局的撤销命令，只记录位置有变化的图元
+class LayoutUndo : public QUndoCommand {
+public:
+    LayoutUndo(QGraphicsScene* scene, const QList<BaseCustomItem*>& items,
+               const QVector<QPointF>& from, const QVector<QPointF>& to)
+        : scene(scene), items(items), from(from), to(to) {
+        setText(QString("布局 %1 个图元").arg(items.size()));
+    }
+
+    void undo() override { apply(from); }
+    void redo() override { apply(to); }
+
+private:
+    void apply(const QVector<QPointF>& positions) {
+        if (!scene) return;
+        SceneIndexSuspender suspender(scene, items.size());
+        for (int i = 0; i < items.size(); ++i) {
+            if (items[i]->scene() == scene) items[i]->setPos(positions[i]);
+        }
+    }
+
+    QPointer<QGraphicsScene> scene;
+    QList<BaseCustomItem*> items;
+    QVector<QPointF> from;
+    QVector<QPointF> to;
+};
+
+
+//*******************************************************************************************/
+// 协程
+//*******************************************************************************************/
+// 在GUI线程恢复协程：投递到主事件循环，不开启嵌套事件循环
+inline void resumeOnGuiThread(std::coroutine_handle<> handle) {
+    QMetaObject::invokeMethod(qApp, [handle]() { handle.resume(); }, Qt::QueuedConnection);
+}
+
+// co_await runInPool(fn)：在线程池中执行 fn，完成后回到GUI线程并返回结果，异常在GUI线程重新抛出
+template <typename F>
+class PoolAwaiter {
+public:
+    using Result = std::invoke_result_t<F&>;
+
+    explicit PoolAwaiter(F fn) : fn(std::move(fn)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        (void)QtConcurrent::run([this, handle]() {
+            try {
+                if constexpr (std::is_void_v<Result>) {
+                    fn();
+                } else {
+                    result.emplace(fn());
+                }
+            } catch (...) {
+                error = std::current_exception();
+            }
+            resumeOnGuiThread(handle);
+        });
+    }
+
+    Result await_resume() {
+        if (error) std::rethrow_exception(error);
+        if constexpr (!std::is_void_v<Result>) {
+            return std::move(*result);
+        }
+    }
+
+private:
+    F fn;
+    std::optional<std::conditional_t<std::is_void_v<Result>, char, Result>> result;
+    std::exception_ptr error;
+};
+
+template <typename F>
+PoolAwaiter<F> runInPool(F fn) {
+    return PoolAwaiter<F>(std::move(fn));
+}
+
+// co_await nextFrame()：让出本轮事件循环，待重绘和输入处理后继续
+struct FrameAwaiter {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+        QTimer::singleShot(0, qApp, [handle]() { handle.resume(); });
+    }
+    void await_resume() const noexcept {}
+};
+
+inline FrameAwaiter nextFrame() {
+    return FrameAwaiter();
+}
+
+// co_await readClipboard(format)：菜单关闭后的下一轮事件循环中读取剪贴板
+struct ClipboardData {
+    QByteArray payload;     // 指定格式的数据，与剪贴板隐式共享
+    QString text;
+};
+
+class ClipboardAwaiter {
+public:
+    explicit ClipboardAwaiter(const QString& format) : format(format) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        QTimer::singleShot(0, qApp, [this, handle]() {
+            QClipboard* clipboard = QApplication::clipboard();
+            if (const QMimeData* mime = clipboard->mimeData()) {
+                if (mime->hasFormat(format)) data.payload = mime->data(format);
+                data.text = mime->text();
+            }
+            handle.resume();
+        });
+    }
+
+    ClipboardData await_resume() { return data; }
+
+private:
+    QString format;
+    ClipboardData data;
+};
+
+inline ClipboardAwaiter readClipboard(const QString& format) {
+    return ClipboardAwaiter(format);
+}
+
+
+//*******************************************************************************************/
+// 右键命令
+//*******************************************************************************************/
+// 组合命令(为了以后扩展)
+class CompositeCommand : public ICommand {
+public:
+    void addCommand(std::shared_ptr<ICommand> cmd) {
+        if(cmd) commands.push_back(std::move(cmd));
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        for (auto& cmd : commands) {
+            if(cmd) cmd->execute(ctx);
+        }
+    }
+
+private:
+    std::vector<std::shared_ptr<ICommand>> commands;
+};
+
+// 命令组合器，用于生成组合命令
+namespace CommandUtils {
+std::shared_ptr<ICommand> combineCommands(std::initializer_list<std::shared_ptr<ICommand>> list) {
+    auto combo = std::make_shared<CompositeCommand>();
+    for (const auto& cmd : list) {
+        combo->addCommand(cmd);
+    }
+    return combo;
+}
+
+// 选中的图元，组合展开为其中的图元；按尺寸、颜色、字体操作的命令都作用于成员
+QList<BaseCustomItem*> memberSelection(CmdCtxPtr ctx) {
+    QList<BaseCustomItem*> items;
+    for (BaseCustomItem* item : ctx->extras.value("selection").value<QList<BaseCustomItem*>>()) {
+        if (item) ItemClipboard::appendFlattened(items, item);
+    }
+    return items;
+}
+}
+
+// 复制命令
+class CopyCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "copy";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        // 选中的对象可能是多个
+        auto list = ctx->extras.value("selection").value<QList<BaseCustomItem*>>();
+        list.removeAll(nullptr);
+        if (list.isEmpty()) return;
+
+        QMimeData* mime = new QMimeData();
+        mime->setData(ItemClipboard::kMimeType, ItemClipboard::encode(list));
+        QApplication::clipboard()->setMimeData(mime);
+
+        for (BaseCustomItem* item : list) {
+            item->copy();
+        }
+    }
+};
+
+// 剪切命令，选中图元写入剪贴板后整批移出场景
+class CutCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "cut";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        auto list = ctx->extras.value("selection").value<QList<BaseCustomItem*>>();
+        list.removeAll(nullptr);
+        if (!ctx->scene || list.isEmpty()) return;
+
+        QMimeData* mime = new QMimeData();
+        mime->setData(ItemClipboard::kMimeType, ItemClipboard::encode(list));
+        QApplication::clipboard()->setMimeData(mime);
+
+        undoStackFor(ctx->scene)->push(new CutItemsUndo(ctx->scene, list));
+        NotificationCenter::GetInstance().count("cut", "已剪切 %1 个图元", list.size());
+    }
+};
+
+// 粘贴命令
+class PasteCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "paste";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        QClipboard* clipboard = QApplication::clipboard();
+        const QMimeData* mime = clipboard->mimeData();
+        if (mime && mime->hasFormat(ItemClipboard::kMimeType)) {
+            paste(ctx, mime->data(ItemClipboard::kMimeType), QString());
+        } else {
+            paste(ctx, QByteArray(), clipboard->text());
+        }
+    }
+
+    // 菜单关闭后再读取剪贴板
+    CommandTask executeAsync(CmdCtxPtr ctx) override {
+        std::shared_ptr<ICommand> self = shared_from_this();
+        QPointer<QGraphicsScene> scene = ctx->scene;
+        ClipboardData data = co_await readClipboard(ItemClipboard::kMimeType);
+        if (ctx->scene && !scene) co_return;     // 等待期间场景已销毁
+        paste(ctx, data.payload, data.text);
+    }
+
+    virtual bool isEnable(CmdCtxPtr ctx) const override {
+        QClipboard* clipboard = QApplication::clipboard();
+        const QMimeData* mime = clipboard->mimeData();
+        if (mime && mime->hasFormat(ItemClipboard::kMimeType)) return true;
+        return !clipboard->text().isEmpty();
+        // return false;
+    }
+
+protected:
+    static const quint32 kSyncPasteLimit = 2000;
+
+    void paste(CmdCtxPtr ctx, const QByteArray& payload, const QString& text) {
+        if (ctx->scene && !payload.isEmpty()) {
+            // QByteArray 隐式共享，解析器直接读取剪贴板持有的数据
+            ItemPayloadReader reader(payload);
+            if (!reader.isValid()) return;
+            QPointF offset = pasteOffset(ctx, reader.bounds());
+
+            // 数据量大时转到后台解码，菜单动作立即返回
+            if (reader.count() > kSyncPasteLimit) {
+                new AsyncPasteJob(ctx->scene, payload, reader.count(), reader.bounds(), offset);
+                return;
+            }
+
+            std::vector<ItemRecord> records;
+            records.reserve(reader.count());
+            ItemRecord record;
+            while (reader.next(record)) {
+                records.push_back(record);
+            }
+            QList<BaseCustomItem*> items = insertRecords(ctx->scene, records, offset);
+            if (!items.isEmpty()) {
+                undoStackFor(ctx->scene)->push(new PasteItemsUndo(ctx->scene, items));
+                NotificationCenter::GetInstance().count("paste", "已粘贴 %1 个图元", items.size());
+            }
+            return;
+        }
+        NotificationCenter& notifications = NotificationCenter::GetInstance();
+        if (notifications.isEnabled() && !text.isEmpty()) {
+            notifications.post("paste.text", "剪贴板文本：" + text.left(80));
+        }
+    }
+
+    // 有右键位置时粘贴到该位置，否则相对原位置偏移
+    static QPointF pasteOffset(CmdCtxPtr ctx, const QRectF& bounds) {
+        if (ctx->extras.contains("scenePos")) {
+            return ctx->extras.value("scenePos").toPointF() - bounds.topLeft();
+        }
+        return QPointF(20, 20);
+    }
+};
+
+// 导出图像命令，选择文件后在后台分块渲染为TIFF
+class ExportImageCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "exportImage";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        executeAsync(ctx);
+    }
+
+    CommandTask executeAsync(CmdCtxPtr ctx) override {
+        std::shared_ptr<ICommand> self = shared_from_this();
+        if (!ctx->scene) co_return;
+        // 空场景在执行时提示，不在菜单弹出时遍历场景判断
+        if (SceneItemList::count(ctx->scene) == 0) {
+            NotificationCenter::GetInstance().post("exportImage", "场景为空，没有可导出的内容");
+            co_return;
+        }
+        QString path = QFileDialog::getSaveFileName(nullptr, "导出图像", "scene.tif", "TIFF (*.tif *.tiff)");
+        if (path.isEmpty()) co_return;
+
+        // 等对话框关闭后的重绘完成再取快照
+        QPointer<QGraphicsScene> scene = ctx->scene;
+        co_await nextFrame();
+        if (!scene) co_return;
+        std::shared_ptr<TiledSceneExporter> exporter = std::make_shared<TiledSceneExporter>(takeSnapshot(scene));
+        bool ok = co_await runInPool([exporter, path]() {
+            return exporter->exportTiff(path, kExportDpi);
+        });
+        NotificationCenter::GetInstance().post("exportImage", (ok ? "已导出：" : "导出失败：") + path);
+    }
+
+private:
+    static const int kExportDpi = 300;
+};
+
+// 批量改变大小的撤销命令，记录实际处理过的图元及其前后尺寸
+// 任务分片执行时已经修改了场景，首次 redo 跳过
+class ResizeItemsUndo : public QUndoCommand {
+public:
+    ResizeItemsUndo(QGraphicsScene* scene, const QList<BaseCustomItem*>& items,
+                    const QVector<QSizeF>& from, const QVector<QSizeF>& to)
+        : scene(scene), items(items), from(from), to(to) {
+        setText(QString("改变 %1 个图元大小").arg(items.size()));
+    }
+
+    void undo() override { apply(from); }
+
+    void redo() override {
+        if (firstRedo) {
+            firstRedo = false;
+            return;
+        }
+        apply(to);
+    }
+
+private:
+    void apply(const QVector<QSizeF>& sizes) {
+        if (!scene) return;
+        SceneIndexSuspender suspender(scene, items.size());
+        for (int i = 0; i < items.size(); ++i) {
+            if (items[i]->scene() == scene) items[i]->setSize(sizes[i]);
+        }
+    }
+
+    QPointer<QGraphicsScene> scene;
+    QList<BaseCustomItem*> items;
+    QVector<QSizeF> from;
+    QVector<QSizeF> to;
+    bool firstRedo = true;
+};
+
+// 改变大小命令：按选中图元的类型，将场景中同类型的全部图元放大，分片执行不阻塞界面
+// 完成或按 Esc 取消时，已处理的部分作为一步撤销提交
+class ResizeAllCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "resizeAll";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        if (!ctx->scene) return;
+        QSet<QString> types;
+        for (BaseCustomItem* item : CommandUtils::memberSelection(ctx)) {
+            types.insert(item->objectType());
+        }
+        if (types.isEmpty()) return;
+
+        QList<BaseCustomItem*> targets;
+        if (SceneItemList* list = SceneItemList::find(ctx->scene)) {
+            for (int i = 0; i < list->size(); ++i) {
+                if (types.contains(list->at(i)->objectType())) targets << list->at(i);
+            }
+        }
+
+        struct Changes {
+            QList<BaseCustomItem*> items;
+            QVector<QSizeF> from;
+            QVector<QSizeF> to;
+        };
+        std::shared_ptr<Changes> changes = std::make_shared<Changes>();
+        auto task = std::make_shared<ItemBatchTask>(ctx->scene, targets, "改变大小", [changes](BaseCustomItem* item) {
+            const QSizeF size = item->itemData().size;
+            changes->items << item;
+            changes->from << size;
+            changes->to << size * kFactor;
+            item->setSize(size * kFactor);
+        });
+        QPointer<QGraphicsScene> scene = ctx->scene;
+        task->setFinished([changes, scene]() {
+            if (!scene || changes->items.isEmpty()) return;
+            undoStackFor(scene)->push(new ResizeItemsUndo(scene, changes->items, changes->from, changes->to));
+        });
+        CooperativeScheduler::GetInstance().submit(task);
+    }
+
+private:
+    static constexpr qreal kFactor = 1.2;
+};
+
+// 旋转命令，选中图元整体绕其中心旋转
+class RotateSelectionCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "rotate";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        QList<BaseCustomItem*> items = CommandUtils::memberSelection(ctx);
+        if (!ctx->scene || items.isEmpty()) return;
+
+        QPointF pivot = BulkTransformEngine(items).pivot();
+        QTransform t = QTransform::fromTranslate(pivot.x(), pivot.y()).rotate(kAngle).translate(-pivot.x(), -pivot.y());
+        undoStackFor(ctx->scene)->push(new BulkTransformUndo(
+            ctx->scene, items, QString("旋转 %1 个图元").arg(items.size()), t, 1.0, kAngle));
+    }
+
+private:
+    static constexpr qreal kAngle = 15;
+};
+
+// 缩放命令，选中图元整体以其中心为基准缩放，尺寸与间距同比变化
+class ScaleSelectionCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "scale";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        QList<BaseCustomItem*> items = CommandUtils::memberSelection(ctx);
+        if (!ctx->scene || items.isEmpty()) return;
+
+        QPointF pivot = BulkTransformEngine(items).pivot();
+        QTransform t = QTransform::fromTranslate(pivot.x(), pivot.y()).scale(kFactor, kFactor).translate(-pivot.x(), -pivot.y());
+        undoStackFor(ctx->scene)->push(new BulkTransformUndo(
+            ctx->scene, items, QString("缩放 %1 个图元").arg(items.size()), t, kFactor, 0));
+    }
+
+private:
+    static constexpr qreal kFactor = 1.25;
+};
+
+// 改变颜色的撤销命令：选中图元改用同一调色板索引，记录各自原索引
+// 命令持有新旧索引的引用，可撤销期间这些颜色不会被调色板回收
+class RecolorItemsUndo : public QUndoCommand {
+public:
+    RecolorItemsUndo(QGraphicsScene* scene, const QList<BaseCustomItem*>& items, const PaletteColor& colorIndex)
+        : scene(scene), items(items), colorIndex(colorIndex) {
+        setText(QString("改变 %1 个图元颜色").arg(items.size()));
+        oldIndices.reserve(items.size());
+        for (BaseCustomItem* item : items) {
+            oldIndices.append(item->itemData().colorIndex);
+        }
+    }
+
+    void undo() override {
+        if (!scene) return;
+        for (int i = 0; i < items.size(); ++i) {
+            if (items[i]->scene() == scene) items[i]->setColorIndex(oldIndices[i]);
+        }
+        scene->update();
+    }
+
+    void redo() override {
+        if (!scene) return;
+        for (BaseCustomItem* item : items) {
+            if (item->scene() == scene) item->setColorIndex(colorIndex);
+        }
+        scene->update();
+    }
+
+private:
+    QPointer<QGraphicsScene> scene;
+    QList<BaseCustomItem*> items;
+    QVector<PaletteColor> oldIndices;
+    PaletteColor colorIndex;
+};
+
+// 改变类型颜色的撤销命令：只修改调色板槽位，不触碰图元
+// 槽位影响文档中所有页面，命令记在文档的撤销栈上，撤销时重绘文档的全部常驻页面（换出的页面换入时按槽位取色）
+class RecolorTypesUndo : public QUndoCommand {
+public:
+    RecolorTypesUndo(QObject* document, const QStringList& types, QRgb value)
+        : document(document), types(types), value(value) {
+        setText(QString("改变 %1 类图元颜色").arg(types.size()));
+        for (const QString& type : types) {
+            oldValues.append(ColorPalette::GetInstance().slotColor(type));
+        }
+    }
+
+    void undo() override {
+        for (int i = 0; i < types.size(); ++i) {
+            ColorPalette::GetInstance().setSlotColor(types[i], oldValues[i]);
+        }
+        refresh();
+    }
+
+    void redo() override {
+        for (const QString& type : types) {
+            ColorPalette::GetInstance().setSlotColor(type, value);
+        }
+        refresh();
+    }
+
+private:
+    void refresh() {
+        if (!document) return;
+        if (QGraphicsScene* scene = qobject_cast<QGraphicsScene*>(document)) scene->update();
+        for (QGraphicsScene* scene : document->findChildren<QGraphicsScene*>(QString(), Qt::FindDirectChildrenOnly)) {
+            scene->update();
+        }
+    }
+
+    QPointer<QObject> document;
+    QStringList types;
+    QVector<QRgb> oldValues;
+    QRgb value;
+};
+
+// 改变颜色命令，选中图元统一改为所选颜色
+class RecolorSelectionCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "recolor";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        QList<BaseCustomItem*> items = CommandUtils::memberSelection(ctx);
+        if (!ctx->scene || items.isEmpty()) return;
+
+        QColor color = QColorDialog::getColor(items.first()->itemData().color(), nullptr, "改变颜色");
+        if (!color.isValid()) return;
+        PaletteColor index = ColorPalette::GetInstance().indexOf(color.rgba());
+        if (ColorPalette::GetInstance().rgba(index) != color.rgba()) {
+            NotificationCenter::GetInstance().post("recolor", "调色板已满，已改用最接近的颜色");
+        }
+        undoStackFor(ctx->scene)->push(new RecolorItemsUndo(ctx->scene, items, index));
+    }
+};
+
+// 改变同类颜色命令，修改选中图元所属类型的默认色，同类图元一并变化
+// 单独改过颜色的图元不在槽位上，保持不变
+class RecolorTypeCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "recolorType";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        if (!ctx->scene) return;
+        QStringList types;
+        for (BaseCustomItem* item : CommandUtils::memberSelection(ctx)) {
+            if (!types.contains(item->objectType()) && ColorPalette::GetInstance().hasSlot(item->objectType())) {
+                types << item->objectType();
+            }
+        }
+        if (types.isEmpty()) return;
+
+        QColor initial = QColor::fromRgba(ColorPalette::GetInstance().slotColor(types.first()));
+        QColor color = QColorDialog::getColor(initial, nullptr, "改变同类颜色");
+        if (!color.isValid()) return;
+        QObject* document = documentOf(ctx->scene);
+        undoStackFor(document)->push(new RecolorTypesUndo(document, types, color.rgba()));
+    }
+};
+
+// 编辑文本的撤销命令：新旧文本是同一棵绳索的两个版本，只有修改路径上的节点不同
+class TextEditUndo : public QUndoCommand {
+public:
+    TextEditUndo(QGraphicsScene* scene, CustomItem* item, int pos, int removed, const QString& text)
+        : scene(scene), item(item), oldText(item->itemData().text) {
+        setText("编辑文本");
+        newText = oldText.replaced(pos, removed, text);
+        first = oldText.paragraphAt(pos);
+        oldCount = oldText.paragraphAt(pos + removed) - first + 1;
+        newCount = newText.paragraphAt(pos + text.size()) - first + 1;
+    }
+
+    void undo() override {
+        if (scene && item->scene() == scene) item->setText(oldText, first, newCount, oldCount);
+    }
+
+    void redo() override {
+        if (scene && item->scene() == scene) item->setText(newText, first, oldCount, newCount);
+    }
+
+private:
+    QPointer<QGraphicsScene> scene;
+    CustomItem* item;
+    TextRope oldText;
+    TextRope newText;
+    int first = 0;
+    int oldCount = 1;
+    int newCount = 1;
+};
+
+// 编辑文本命令，编辑右键点击处的段落，只把与原段落不同的部分作为一次替换提交
+class EditTextCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "editText";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        CustomItem* item = textItem(ctx);
+        if (!item) return;
+
+        // 只编辑点击处的段落，复制与比较的代价只与该段长度有关，与全文长度无关
+        const TextRope text = item->itemData().text;
+        int index = 0;
+        if (ctx->extras.contains("scenePos")) {
+            index = item->paragraphAt(item->mapFromScene(ctx->extras.value("scenePos").toPointF()));
+        }
+        const QString before = text.paragraph(index);
+        bool ok = false;
+        const QString after = QInputDialog::getMultiLineText(nullptr, QString("编辑文本（第 %1 段）").arg(index + 1),
+                                                             "文本", before, &ok);
+        if (!ok || after == before || !item->itemData().text.isSameVersion(text)) return;
+
+        // 公共前后缀之外的部分即为修改区间
+        int prefix = 0;
+        const int shorter = qMin(before.size(), after.size());
+        while (prefix < shorter && before[prefix] == after[prefix]) ++prefix;
+        int suffix = 0;
+        while (suffix < shorter - prefix && before[before.size() - 1 - suffix] == after[after.size() - 1 - suffix]) ++suffix;
+
+        undoStackFor(ctx->scene)->push(new TextEditUndo(ctx->scene, item, text.paragraphStart(index) + prefix,
+            before.size() - prefix - suffix, after.mid(prefix, after.size() - prefix - suffix)));
+    }
+
+    bool isEnable(CmdCtxPtr ctx) const override {
+        return textItem(ctx) != nullptr;
+    }
+
+private:
+    static CustomItem* textItem(CmdCtxPtr ctx) {
+        BaseCustomItem* item = dynamic_cast<BaseCustomItem*>(ctx->item);
+        if (!ctx->scene || !item || item->objectType() != "TextItem") return nullptr;
+        return static_cast<CustomItem*>(item);
+    }
+};
+
+// 改变字体的撤销命令：记录各图元原字体（隐式共享，每个图元一个指针）
+class FontChangeUndo : public QUndoCommand {
+public:
+    FontChangeUndo(QGraphicsScene* scene, const QList<CustomItem*>& items, const QFont& font)
+        : scene(scene), items(items), font(font) {
+        setText(QString("改变 %1 个图元字体").arg(items.size()));
+        oldFonts.reserve(items.size());
+        for (CustomItem* item : items) {
+            oldFonts.append(item->itemData().font);
+        }
+    }
+
+    void undo() override {
+        if (!scene) return;
+        for (int i = 0; i < items.size(); ++i) {
+            if (items[i]->scene() == scene) items[i]->setFont(oldFonts[i]);
+        }
+        scene->update();
+    }
+
+    void redo() override {
+        if (!scene) return;
+        for (CustomItem* item : items) {
+            if (item->scene() == scene) item->setFont(font);
+        }
+        scene->update();
+    }
+
+private:
+    QPointer<QGraphicsScene> scene;
+    QList<CustomItem*> items;
+    QVector<QFont> oldFonts;
+    QFont font;
+};
+
+// 改变字体命令，作用于选中的文本图元
+// 先收集各图元可见段落，去重后在线程池中排版进共享缓存，再统一换字体重绘，每种文本只排版一次
+class ChangeFontCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "changeFont";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        executeAsync(ctx);
+    }
+
+    CommandTask executeAsync(CmdCtxPtr ctx) override {
+        std::shared_ptr<ICommand> self = shared_from_this();
+        QList<CustomItem*> items = textItems(ctx);
+        if (items.isEmpty()) co_return;
+
+        bool ok = false;
+        QFont font = QFontDialog::getFont(&ok, items.first()->itemData().font, nullptr, "改变字体");
+        if (!ok) co_return;
+
+        // 同尺寸的图元排版宽度相同，按宽度分组去重
+        QHash<int, QSet<QString>> distinct;
+        for (CustomItem* item : items) {
+            QRectF rect = CustomItem::textRect(item->itemData().size);
+            for (const QString& paragraph : ParagraphLayoutCache::visibleParagraphs(item->itemData().text, font, rect.height())) {
+                distinct[qRound(rect.width() * 64)].insert(paragraph);
+            }
+        }
+        std::vector<std::pair<qreal, QString>> work;
+        for (auto it = distinct.constBegin(); it != distinct.constEnd(); ++it) {
+            for (const QString& paragraph : it.value()) {
+                work.emplace_back(it.key() / 64.0, paragraph);
+            }
+        }
+
+        QPointer<QGraphicsScene> scene = ctx->scene;
+        co_await runInPool([&work, font]() {
+            QtConcurrent::blockingMap(work, [font](const std::pair<qreal, QString>& entry) {
+                SharedLayoutCache::GetInstance().layout(entry.second, font, entry.first);
+            });
+        });
+        if (!scene) co_return;
+        undoStackFor(scene)->push(new FontChangeUndo(scene, items, font));
+    }
+
+    bool isEnable(CmdCtxPtr ctx) const override {
+        return !textItems(ctx).isEmpty();
+    }
+
+private:
+    static QList<CustomItem*> textItems(CmdCtxPtr ctx) {
+        QList<CustomItem*> result;
+        if (!ctx->scene) return result;
+        for (BaseCustomItem* item : CommandUtils::memberSelection(ctx)) {
+            if (item->objectType() == "TextItem") result << static_cast<CustomItem*>(item);
+        }
+        return result;
+    }
+};
+
+// 版式布局命令：网格、流式、对齐参考线，作用于场景中全部顶层图元
+// 按父坐标系下的外框排布（组合没有自己的尺寸，旋转的图元外框大于尺寸），写回时扣除外框相对 pos 的偏移
+class LayoutCommand : public ICommand {
+public:
+    explicit LayoutCommand(LayoutState::Mode mode) : mode(mode) {}
+
+    QString commandId() const override {
+        switch (mode) {
+        case LayoutState::Flow: return "layoutFlow";
+        case LayoutState::Align: return "layoutAlign";
+        default: return "layoutGrid";
+        }
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        executeAsync(ctx);
+    }
+
+    CommandTask executeAsync(CmdCtxPtr ctx) override {
+        std::shared_ptr<ICommand> self = shared_from_this();
+        QPointer<QGraphicsScene> scene = ctx->scene;
+        if (!scene) co_return;
+
+        // 按创建顺序排列，保证多次布局的序列一致
+        QList<BaseCustomItem*> targets;
+        if (SceneItemList* list = SceneItemList::find(scene)) {
+            for (int i = 0; i < list->size(); ++i) {
+                if (!list->at(i)->parentItem()) targets << list->at(i);
+            }
+        }
+        std::sort(targets.begin(), targets.end(), [](BaseCustomItem* a, BaseCustomItem* b) { return a->id() < b->id(); });
+        if (targets.isEmpty()) co_return;
+
+        std::vector<LayoutItem> input;
+        QVector<QPointF> offsets;
+        input.reserve(size_t(targets.size()));
+        offsets.reserve(targets.size());
+        for (BaseCustomItem* item : targets) {
+            const QRectF rect = item->mapRectToParent(item->boundingRect());
+            input.push_back(LayoutItem{item->id(), rect.size(), rect.topLeft()});
+            offsets << item->pos() - rect.topLeft();
+        }
+        LayoutParams params;
+        params.width = qMax<qreal>(400, scene->sceneRect().width() - 2 * params.origin.x());
+
+        LayoutState::Mode layoutMode = mode;
+        std::shared_ptr<const LayoutState> previous = LayoutSession::of(scene)->state;
+        std::shared_ptr<const LayoutState> state = co_await runInPool([layoutMode, params, input = std::move(input), previous]() {
+            return AutoLayout::compute(layoutMode, params, input, previous);
+        });
+        if (!scene) co_return;
+        LayoutSession::of(scene)->state = state;
+
+        QList<BaseCustomItem*> moved;
+        QVector<QPointF> from, to;
+        for (int i = 0; i < targets.size(); ++i) {
+            BaseCustomItem* item = targets[i];
+            const QPointF pos = state->positions[size_t(i)] + offsets[i];
+            if (item->scene() != scene || item->pos() == pos) continue;
+            moved << item;
+            from << item->pos();
+            to << pos;
+        }
+        if (!moved.isEmpty()) {
+            undoStackFor(scene)->push(new LayoutUndo(scene, moved, from, to));
+        }
+    }
+
+private:
+    LayoutState::Mode mode;
+};
+
+// 层级调整的撤销命令，记录每个被改动图元的新旧Z键
+class ZOrderUndo : public QUndoCommand {
+public:
+    ZOrderUndo(QGraphicsScene* scene, const QString& text, const QHash<BaseCustomItem*, qreal>& oldKeys)
+        : scene(scene), oldKeys(oldKeys) {
+        setText(text);
+        for (auto it = oldKeys.constBegin(); it != oldKeys.constEnd(); ++it) {
+            newKeys.insert(it.key(), it.key()->zValue());
+        }
+    }
+
+    void undo() override { apply(oldKeys); }
+
+    void redo() override {
+        // 首次入栈时已在命令中生效
+        if (firstRedo) {
+            firstRedo = false;
+            return;
+        }
+        apply(newKeys);
+    }
+
+private:
+    void apply(const QHash<BaseCustomItem*, qreal>& keys) {
+        if (!scene) return;
+        for (auto it = keys.constBegin(); it != keys.constEnd(); ++it) {
+            if (it.key()->scene() == scene) it.key()->setZValue(it.value());
+        }
+    }
+
+    QPointer<QGraphicsScene> scene;
+    QHash<BaseCustomItem*, qreal> oldKeys;
+    QHash<BaseCustomItem*, qreal> newKeys;
+    bool firstRedo = true;
+};
+
+// 层级命令：置于顶层、置于底层、上移一层、下移一层，作用于选中图元
+// 每个图元只分配一个新键，相对次序保持不变；Z值不参与BSP索引，兄弟项排序由Qt延迟到下次绘制时一次完成
+// 上移/下移越过叠放次序中相邻的未选中图元，相邻图元取自场景的叠放次序，每个图元 O(1)
+class ZOrderCommand : public ICommand {
+public:
+    enum Kind { BringToFront, SendToBack, MoveUp, MoveDown };
+
+    explicit ZOrderCommand(Kind kind) : kind(kind) {}
+
+    QString commandId() const override {
+        switch (kind) {
+        case BringToFront: return "bringToFront";
+        case SendToBack: return "sendToBack";
+        case MoveUp: return "moveUp";
+        default: return "moveDown";
+        }
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        QList<BaseCustomItem*> items = ctx->extras.value("selection").value<QList<BaseCustomItem*>>();
+        items.removeAll(nullptr);
+        if (!ctx->scene || items.isEmpty()) return;
+
+        // 按当前层级排序，保持选中图元之间的相对次序
+        std::stable_sort(items.begin(), items.end(), [](BaseCustomItem* a, BaseCustomItem* b) {
+            return a->zValue() < b->zValue();
+        });
+
+        QGraphicsScene* scene = ctx->scene;
+        QHash<BaseCustomItem*, qreal> oldKeys;
+        auto setKey = [&oldKeys](BaseCustomItem* item, qreal key) {
+            if (!oldKeys.contains(item)) oldKeys.insert(item, item->zValue());
+            item->setZValue(key);
+        };
+
+        switch (kind) {
+        case BringToFront:
+            for (BaseCustomItem* item : items) setKey(item, ZOrderKeys::nextTop(scene));
+            break;
+        case SendToBack:
+            for (auto it = items.crbegin(); it != items.crend(); ++it) setKey(*it, ZOrderKeys::nextBottom(scene));
+            break;
+        case MoveUp:
+        case MoveDown: {
+            QSet<BaseCustomItem*> selected(items.begin(), items.end());
+            const SceneItemList::Stack& stack = SceneItemList::of(scene)->stack();
+            // 上移从最上面的选中图元开始，下移从最下面开始，互不越过
+            if (kind == MoveUp) std::reverse(items.begin(), items.end());
+            for (BaseCustomItem* item : items) {
+                qreal key = 0;
+                Step step = stepKey(stack, item, selected, kind == MoveUp, key);
+                if (step == Crowded) {
+                    ZOrderKeys::renumber(scene, oldKeys);
+                    step = stepKey(stack, item, selected, kind == MoveUp, key);
+                }
+                if (step == Moved) setKey(item, key);
+            }
+            break;
+        }
+        }
+
+        if (!oldKeys.isEmpty()) {
+            undoStackFor(scene)->push(new ZOrderUndo(scene, QString("调整 %1 个图元层级").arg(items.size()), oldKeys));
+        }
+    }
+
+private:
+    enum Step { Unchanged, Moved, Crowded };
+
+    // 越过叠放次序中相邻的未选中图元所需的新键；两侧键间距不足时返回 Crowded，需先重新编号
+    // 移动方向上的选中图元已先处理：能移动的已越过其相邻图元，紧邻本图元的只可能是到顶而未移动的，本图元同样不动
+    static Step stepKey(const SceneItemList::Stack& stack, BaseCustomItem* item, const QSet<BaseCustomItem*>& selected,
+                        bool up, qreal& key) {
+        if (!item->isStacked()) return Unchanged;
+        SceneItemList::Stack::const_iterator near = item->stackPosition();
+        SceneItemList::Stack::const_iterator far;
+        if (up) {
+            if (++near == stack.cend()) return Unchanged;
+            far = std::next(near);
+        } else {
+            if (near == stack.cbegin()) return Unchanged;
+            --near;
+            far = near == stack.cbegin() ? stack.cend() : std::prev(near);
+        }
+        if (selected.contains(near->second)) return Unchanged;
+
+        const qreal gap = up ? ZOrderKeys::kGap : -ZOrderKeys::kGap;
+        const qreal nearKey = near->first;
+        const qreal farKey = far != stack.cend() ? far->first : nearKey + 2 * gap;
+        if (qAbs(farKey - nearKey) < ZOrderKeys::kMinGap) return Crowded;
+        key = (nearKey + farKey) / 2;
+        return Moved;
+    }
+
+    Kind kind;
+};
+
+// 组合的撤销命令：组合对象由本命令创建，在场景中时归场景所有，撤销后由本命令释放
+// 场景析构时组合可能先于撤销栈被删除，析构时只依据自身状态判断，不访问组合
+class GroupUndo : public QUndoCommand {
+public:
+    GroupUndo(QGraphicsScene* scene, const QList<BaseCustomItem*>& items)
+        : scene(scene), items(items), group(new GroupItem()) {
+        setText(QString("组合 %1 个图元").arg(items.size()));
+    }
+
+    ~GroupUndo() override {
+        if (!grouped) delete group;
+    }
+
+    void undo() override {
+        if (!scene || !grouped) return;
+        SceneIndexSuspender suspender(scene, items.size());
+        group->release();
+        scene->removeItem(group);
+        grouped = false;
+    }
+
+    void redo() override {
+        if (!scene || grouped) return;
+        QRectF bounds;
+        for (BaseCustomItem* item : items) bounds |= item->sceneBoundingRect();
+
+        scene->clearSelection();
+        SceneIndexSuspender suspender(scene, items.size());
+        group->setPos(bounds.topLeft());
+        group->setZValue(ZOrderKeys::nextTop(scene));
+        scene->addItem(group);
+        group->adopt(items);
+        group->setSelected(true);
+        grouped = true;
+    }
+
+private:
+    QPointer<QGraphicsScene> scene;
+    QList<BaseCustomItem*> items;
+    GroupItem* group;
+    bool grouped = false;
+};
+
+// 取消组合的撤销命令：组合对象保留在本命令中，撤销时原样放回
+class UngroupUndo : public QUndoCommand {
+public:
+    UngroupUndo(QGraphicsScene* scene, GroupItem* group)
+        : scene(scene), group(group) {
+        setText("取消组合");
+    }
+
+    ~UngroupUndo() override {
+        if (ungrouped) delete group;
+    }
+
+    void undo() override {
+        if (!scene || !ungrouped) return;
+        scene->clearSelection();
+        SceneIndexSuspender suspender(scene, items.size());
+        scene->addItem(group);
+        group->adopt(items);
+        group->setSelected(true);
+        ungrouped = false;
+    }
+
+    void redo() override {
+        if (!scene || ungrouped || group->scene() != scene) return;
+        SceneIndexSuspender suspender(scene, group->childItems().size());
+        items = group->release();
+        scene->removeItem(group);
+        ungrouped = true;
+    }
+
+private:
+    QPointer<QGraphicsScene> scene;
+    GroupItem* group;
+    QList<BaseCustomItem*> items;
+    bool ungrouped = false;
+};
+
+// 组合命令，选中的顶层图元合为一个组合
+class GroupCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "group";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        QList<BaseCustomItem*> items = topLevelSelection(ctx);
+        if (!ctx->scene || items.size() < 2) return;
+        undoStackFor(ctx->scene)->push(new GroupUndo(ctx->scene, items));
+    }
+
+    bool isEnable(CmdCtxPtr ctx) const override {
+        return topLevelSelection(ctx).size() >= 2;
+    }
+
+private:
+    static QList<BaseCustomItem*> topLevelSelection(CmdCtxPtr ctx) {
+        QList<BaseCustomItem*> items = ctx->extras.value("selection").value<QList<BaseCustomItem*>>();
+        items.removeAll(nullptr);
+        items.erase(std::remove_if(items.begin(), items.end(), [](BaseCustomItem* item) { return item->parentItem() != nullptr; }),
+                    items.end());
+        return items;
+    }
+};
+
+// 取消组合命令，作用于选中的组合
+class UngroupCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "ungroup";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        if (!ctx->scene) return;
+        QList<GroupItem*> groups = selectedGroups(ctx);
+        if (groups.isEmpty()) return;
+
+        QUndoStack* stack = undoStackFor(ctx->scene);
+        stack->beginMacro(QString("取消 %1 个组合").arg(groups.size()));
+        for (GroupItem* group : groups) {
+            stack->push(new UngroupUndo(ctx->scene, group));
+        }
+        stack->endMacro();
+    }
+
+    bool isEnable(CmdCtxPtr ctx) const override {
+        return !selectedGroups(ctx).isEmpty();
+    }
+
+private:
+    static QList<GroupItem*> selectedGroups(CmdCtxPtr ctx) {
+        QList<GroupItem*> groups;
+        for (BaseCustomItem* item : ctx->extras.value("selection").value<QList<BaseCustomItem*>>()) {
+            if (item && item->objectType() == "Group") groups << static_cast<GroupItem*>(item);
+        }
+        return groups;
+    }
+};
+
+// 创建副本命令：副本与原图元共享同一份数据（写时复制），只增加引用计数，任一方修改时才各自拷贝
+// 副本从对象池取出；组合复制为新组合，其中的图元同样共享数据
+class DuplicateCommand : public ICommand {
+public:
+    QString commandId() const override {
+        return "duplicate";
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        QList<BaseCustomItem*> selection = ctx->extras.value("selection").value<QList<BaseCustomItem*>>();
+        selection.removeAll(nullptr);
+        if (!ctx->scene || selection.isEmpty()) return;
+
+        // 只用于决定是否暂停索引，组合按直接成员估算
+        int total = 0;
+        for (BaseCustomItem* item : selection) {
+            total += 1 + item->childItems().size();
+        }
+
+        QGraphicsScene* scene = ctx->scene;
+        QList<BaseCustomItem*> copies;
+        copies.reserve(selection.size());
+        scene->clearSelection();
+        {
+            SceneIndexSuspender suspender(scene, total);
+            for (BaseCustomItem* original : selection) {
+                BaseCustomItem* copy = duplicate(scene, original);
+                if (!copy) continue;
+                copy->setSelected(true);
+                copies << copy;
+            }
+        }
+        if (copies.isEmpty()) return;
+
+        // 撤销与粘贴相同：移出场景的副本由命令持有，最终归还对象池
+        PasteItemsUndo* undo = new PasteItemsUndo(scene, copies);
+        undo->setText(QString("创建 %1 个副本").arg(copies.size()));
+        undoStackFor(scene)->push(undo);
+        NotificationCenter::GetInstance().count("duplicate", "已创建 %1 个副本", copies.size());
+    }
+
+private:
+    // 复制一个图元并加入场景顶层；组合先复制其中的图元，再收入新组合
+    static BaseCustomItem* duplicate(QGraphicsScene* scene, BaseCustomItem* original) {
+        BaseCustomItem* copy = ItemPool::GetInstance().acquire(original->objectType());
+        if (!copy) return nullptr;
+        copy->setItemData(original->sharedData());
+        copy->setPos(original->positionInScene() + QPointF(kOffset, kOffset));
+        copy->setZValue(ZOrderKeys::nextTop(scene));
+        scene->addItem(copy);
+
+        if (original->objectType() == "Group") {
+            QList<BaseCustomItem*> members;
+            for (QGraphicsItem* child : original->childItems()) {
+                BaseCustomItem* baseChild = dynamic_cast<BaseCustomItem*>(child);
+                if (BaseCustomItem* member = baseChild ? duplicate(scene, baseChild) : nullptr) members << member;
+            }
+            static_cast<GroupItem*>(copy)->adopt(members);
+        }
+        return copy;
+    }
+
+private:
+    static constexpr qreal kOffset = 20;
+};
+
+// 空命令，什么也不做
+class NullCommand : public ICommand {
+public:
+    void execute(CmdCtxPtr ctx) override {
+        // do nothing
+    }
+};
+
+// 自定义命令1
+class CustomCommand1 : public ICommand {
+public:
+    void execute(CmdCtxPtr ctx) override {
+        qDebug() << "CustomCommand1 executed";
+    }
+};
+
+// 自定义命令2
+class CustomCommand2 : public ICommand {
+public:
+    void execute(CmdCtxPtr ctx) override {
+        qDebug() << "CustomCommand2 executed";
+    }
+};
+
+// 命令注册表，按命令ID创建命令（声明式菜单定义使用）
+class CommandRegistry {
+public:
+    using Creator = std::function<std::shared_ptr<ICommand>()>;
+
+    // 单例
+    static CommandRegistry& GetInstance() {
+        static CommandRegistry registry;
+        return registry;
+    }
+
+    void registerCreator(const QString& id, Creator creator) {
+        creators[id] = creator;
+    }
+
+    std::shared_ptr<ICommand> create(const QString& id) const {
+        auto it = creators.constFind(id);
+        if (it != creators.constEnd()) {
+            return it.value()();
+        }
+        return nullptr;
+    }
+
+private:
+    QMap<QString, Creator> creators;
+};
+
+
+//*******************************************************************************************/
+// 图标
+//*******************************************************************************************/
+// 菜单图标注册表，按命令ID引用
+// SVG 在启动时由工作线程解析一次；每个设备像素比只光栅化一次，结果放入按字节计费的共享 LRU 缓存
+class IconRegistry {
+public:
+    // 单例
+    static IconRegistry& GetInstance() {
+        static IconRegistry registry;
+        return registry;
+    }
+
+    // 目录中的 <命令ID>.svg
+    void registerDirectory(const QString& path) {
+        QDir dir(path);
+        for (const QFileInfo& info : dir.entryInfoList(QStringList() << "*.svg", QDir::Files)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            sources.insert(info.completeBaseName(), info.absoluteFilePath());
+        }
+    }
+
+    // 后台解析全部已注册的SVG
+    void preload() {
+        QStringList ids;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ids = sources.keys();
+        }
+        QThread* guiThread = QCoreApplication::instance()->thread();
+        loading = QtConcurrent::run([this, ids, guiThread]() {
+            for (const QString& id : ids) {
+                parse(id, guiThread);
+            }
+        });
+    }
+
+    QIcon icon(const QString& commandId, qreal dpr) {
+        if (commandId.isEmpty()) return QIcon();
+
+        QString key = commandId + QLatin1Char('@') + QString::number(dpr);
+        if (QPixmap* cached = rasters.object(key)) {
+            return QIcon(*cached);
+        }
+
+        std::shared_ptr<QSvgRenderer> renderer = parse(commandId, QThread::currentThread());
+        if (!renderer) return QIcon();
+
+        QImage image(QSize(kIconSize, kIconSize) * dpr, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        QPainter painter(&image);
+        renderer->render(&painter);
+        painter.end();
+
+        QPixmap* pixmap = new QPixmap(QPixmap::fromImage(image));
+        pixmap->setDevicePixelRatio(dpr);
+        QIcon result(*pixmap);
+        rasters.insert(key, pixmap, image.sizeInBytes());
+        return result;
+    }
+
+private:
+    static const int kIconSize = 16;
+    static const int kRasterBudget = 4 * 1024 * 1024;
+
+    IconRegistry() : rasters(kRasterBudget) {}
+
+    ~IconRegistry() {
+        loading.waitForFinished();
+    }
+
+    // 每个SVG只解析一次，工作线程解析后移交GUI线程
+    std::shared_ptr<QSvgRenderer> parse(const QString& id, QThread* owner) {
+        QString path;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = renderers.constFind(id);
+            if (it != renderers.constEnd()) return it.value();
+            path = sources.value(id);
+        }
+        if (path.isEmpty()) return nullptr;
+
+        std::shared_ptr<QSvgRenderer> renderer = std::make_shared<QSvgRenderer>(path);
+        if (!renderer->isValid()) renderer.reset();
+        else renderer->moveToThread(owner);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = renderers.constFind(id);
+        if (it != renderers.constEnd()) return it.value();   // 另一线程已先完成
+        renderers.insert(id, renderer);
+        return renderer;
+    }
+
+    std::mutex mutex;
+    QHash<QString, QString> sources;
+    QHash<QString, std::shared_ptr<QSvgRenderer>> renderers;
+    QCache<QString, QPixmap> rasters;   // 仅GUI线程访问
+    QFuture<void> loading;
+};
+
+
+//*******************************************************************************************/
+// 右键菜单
+//*******************************************************************************************/
+// 虚拟列表的数据源：条目数、按下标取文本、激活回调，条目在弹出时才取
+struct VirtualListSource {
+    std::function<int()> count;
+    std::function<QString(int)> text;
+    std::function<void(int)> activate;
+};
+
+// 虚拟列表模型，只按需返回可见行的数据；过滤结果保存为源下标
+class VirtualListModel : public QAbstractListModel {
+public:
+    void setSource(const VirtualListSource& value) {
+        beginResetModel();
+        source = value;
+        total = source.count ? source.count() : 0;
+        filter.clear();
+        matches.clear();
+        endResetModel();
+    }
+
+    // 增量过滤：新关键字是上次的延伸时只在上次结果中筛选
+    void setFilter(const QString& text) {
+        beginResetModel();
+        if (text.isEmpty()) {
+            matches.clear();
+        } else if (!filter.isEmpty() && text.startsWith(filter)) {
+            std::vector<int> narrowed;
+            for (int index : matches) {
+                if (source.text(index).contains(text, Qt::CaseInsensitive)) narrowed.push_back(index);
+            }
+            matches.swap(narrowed);
+        } else {
+            matches.clear();
+            for (int i = 0; i < total; ++i) {
+                if (source.text(i).contains(text, Qt::CaseInsensitive)) matches.push_back(i);
+            }
+        }
+        filter = text;
+        endResetModel();
+    }
+
+    int sourceIndex(int row) const {
+        return filter.isEmpty() ? row : matches[row];
+    }
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override {
+        if (parent.isValid()) return 0;
+        return filter.isEmpty() ? total : int(matches.size());
+    }
+
+    QVariant data(const QModelIndex& index, int role) const override {
+        if (!index.isValid() || role != Qt::DisplayRole) return QVariant();
+        return source.text(sourceIndex(index.row()));
+    }
+
+private:
+    VirtualListSource source;
+    int total = 0;
+    QString filter;
+    std::vector<int> matches;
+};
+
+// 虚拟化弹出列表：QListView 统一行高时只布局可见行，打开耗时与条目数无关；支持输入过滤
+class VirtualListPopup : public QWidget {
+public:
+    explicit VirtualListPopup(const VirtualListSource& source, QWidget* parent = nullptr)
+        : QWidget(parent), source(source) {
+        filterEdit = new QLineEdit(this);
+        filterEdit->setPlaceholderText("输入以过滤");
+        filterEdit->installEventFilter(this);
+
+        listView = new QListView(this);
+        listView->setUniformItemSizes(true);
+        listView->setModel(&model);
+
+        QVBoxLayout* layout = new QVBoxLayout(this);
+        layout->setContentsMargins(4, 4, 4, 4);
+        layout->addWidget(filterEdit);
+        layout->addWidget(listView);
+        setFixedSize(260, 320);
+
+        QObject::connect(filterEdit, &QLineEdit::textChanged, [this](const QString& text) {
+            model.setFilter(text);
+            listView->setCurrentIndex(model.index(0));
+        });
+        QObject::connect(listView, &QListView::activated, [this](const QModelIndex& index) {
+            activate(index);
+        });
+        QObject::connect(listView, &QListView::clicked, [this](const QModelIndex& index) {
+            activate(index);
+        });
+    }
+
+protected:
+    // 首次显示时才向数据源取条目数
+    void showEvent(QShowEvent* event) override {
+        if (!loaded) {
+            model.setSource(source);
+            loaded = true;
+        }
+        filterEdit->setFocus();
+        QWidget::showEvent(event);
+    }
+
+    // 过滤框中用上下键移动、回车激活
+    bool eventFilter(QObject* watched, QEvent* event) override {
+        if (watched == filterEdit && event->type() == QEvent::KeyPress) {
+            QKeyEvent* keyEvent = static_cast<QKeyEvent*>(event);
+            int row = listView->currentIndex().row();
+            switch (keyEvent->key()) {
+            case Qt::Key_Down:
+                listView->setCurrentIndex(model.index(qMin(row + 1, model.rowCount() - 1)));
+                return true;
+            case Qt::Key_Up:
+                listView->setCurrentIndex(model.index(qMax(row - 1, 0)));
+                return true;
+            case Qt::Key_Return:
+            case Qt::Key_Enter:
+                activate(listView->currentIndex());
+                return true;
+            default:
+                break;
+            }
+        }
+        return QWidget::eventFilter(watched, event);
+    }
+
+private:
+    void activate(const QModelIndex& index) {
+        if (!index.isValid()) return;
+        int sourceIndex = model.sourceIndex(index.row());
+        // 关闭所在的各级菜单
+        for (QWidget* w = parentWidget(); w; w = w->parentWidget()) {
+            if (QMenu* menu = qobject_cast<QMenu*>(w)) menu->close();
+        }
+        if (source.activate) source.activate(sourceIndex);
+    }
+
+    VirtualListSource source;
+    VirtualListModel model;
+    QLineEdit* filterEdit;
+    QListView* listView;
+    bool loaded = false;
+};
+
+// 动态菜单条目，key 唯一标识条目，用于增量比对
+struct DynamicMenuEntry {
+    QString key;
+    QString text;
+    bool enabled;
+    std::function<void()> trigger;
+};
+
+// 数据驱动的动态子菜单：跨多次弹出保留同一个 QMenu 与其 QAction，
+// 每次按 key 与新数据比对，只执行插入、删除、改名和移动
+class DynamicMenuSection {
+public:
+    explicit DynamicMenuSection(const QString& title) : title(title) {}
+
+    ~DynamicMenuSection() {
+        // 静态对象析构时应用可能已退出，此时不再删除窗口对象
+        if (menu && QCoreApplication::instance()) delete menu;
+    }
+
+    QMenu* update(const std::vector<DynamicMenuEntry>& entries) {
+        if (!menu) {
+            menu = new QMenu(title);   // 无父对象，宿主菜单销毁时保留
+            actions.clear();
+            triggers->clear();
+        }
+
+        QSet<QString> keys;
+        for (const DynamicMenuEntry& entry : entries) keys.insert(entry.key);
+
+        // 删除
+        for (auto it = actions.begin(); it != actions.end(); ) {
+            if (keys.contains(it.key())) {
+                ++it;
+                continue;
+            }
+            menu->removeAction(it.value());
+            delete it.value();
+            triggers->remove(it.key());
+            it = actions.erase(it);
+        }
+
+        // 插入、改名、移动
+        QList<QAction*> current = menu->actions();
+        for (int i = 0; i < int(entries.size()); ++i) {
+            const DynamicMenuEntry& entry = entries[i];
+            QAction* action = actions.value(entry.key);
+            if (!action) {
+                action = new QAction(entry.text, menu);
+                std::shared_ptr<QHash<QString, std::function<void()>>> table = triggers;
+                QString key = entry.key;
+                QObject::connect(action, &QAction::triggered, [table, key]() {
+                    std::function<void()> trigger = table->value(key);
+                    if (trigger) trigger();
+                });
+                actions.insert(entry.key, action);
+            } else if (action->text() != entry.text) {
+                action->setText(entry.text);
+            }
+            action->setEnabled(entry.enabled);
+            triggers->insert(entry.key, entry.trigger);
+
+            if (i < current.size() && current[i] == action) continue;
+            menu->insertAction(i < current.size() ? current[i] : nullptr, action);
+            current.removeOne(action);
+            current.insert(i, action);
+        }
+        return menu;
+    }
+
+private:
+    QString title;
+    QPointer<QMenu> menu;
+    QHash<QString, QAction*> actions;
+    // 回调每次弹出都会更新（持有新的上下文），action 只连接一次
+    std::shared_ptr<QHash<QString, std::function<void()>>> triggers = std::make_shared<QHash<QString, std::function<void()>>>();
+};
+
+// 最近执行的命令（按命令ID去重，最近的在前）
+class RecentCommands {
+public:
+    struct Entry {
+        QString id;
+        QString text;
+        std::shared_ptr<ICommand> cmd;
+    };
+
+    // 单例
+    static RecentCommands& GetInstance() {
+        static RecentCommands recent;
+        return recent;
+    }
+
+    void record(const QString& id, const QString& text, std::shared_ptr<ICommand> cmd) {
+        if (id.isEmpty()) return;
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->id == id) {
+                entries.erase(it);
+                break;
+            }
+        }
+        Entry entry;
+        entry.id = id;
+        entry.text = text;
+        entry.cmd = std::move(cmd);
+        entries.push_front(entry);
+        if (entries.size() > kMaxEntries) entries.pop_back();
+    }
+
+    const std::deque<Entry>& list() const { return entries; }
+
+private:
+    static const size_t kMaxEntries = 10;
+    std::deque<Entry> entries;
+};
+
+// 内置策略的基类，提供添加命令项、动态分组、虚拟列表等辅助函数；插件策略经 MenuHost 添加命令项
+class BuiltinMenuStrategy : public MenuStrategy {
+public:
+    static void addCommandAction(QMenu* menu, const QString& text,
+                                 std::shared_ptr<ICommand> cmd,
+                                 CmdCtxPtr ctx) {
+        if (!cmd || !cmd->isVisible(ctx)) return;
+
+        auto* action = menu->addAction(text);
+        action->setEnabled(cmd->isEnable(ctx));
+        QIcon icon = IconRegistry::GetInstance().icon(cmd->commandId(), menu->devicePixelRatioF());
+        if (!icon.isNull()) action->setIcon(icon);
+        QObject::connect(action, &QAction::triggered, [cmd, ctx, text]() {
+            RecentCommands::GetInstance().record(cmd->commandId(), text, cmd);
+            cmd->executeAsync(ctx);
+        });
+    }
+
+protected:
+    void addCommandAction(QMenu* menu, const QString& text, CmdCtxPtr ctx) {
+        addCommandAction(menu, text, std::make_shared<NullCommand>(), ctx);
+    }
+
+    // 数据驱动的子菜单，section 需跨弹出保留（如静态对象），每次只应用差异
+    void addDynamicSection(QMenu* menu, DynamicMenuSection& section, const std::vector<DynamicMenuEntry>& entries) {
+        if (entries.empty()) return;
+        menu->addMenu(section.update(entries));
+    }
+
+    // 最近执行的命令，作用于本次弹出的上下文
+    void addRecentCommandsSection(QMenu* menu, CmdCtxPtr ctx) {
+        static DynamicMenuSection section("最近命令");
+        std::vector<DynamicMenuEntry> entries;
+        for (const RecentCommands::Entry& recent : RecentCommands::GetInstance().list()) {
+            if (!recent.cmd->isVisible(ctx)) continue;
+            DynamicMenuEntry entry;
+            entry.key = recent.id;
+            entry.text = recent.text;
+            entry.enabled = recent.cmd->isEnable(ctx);
+            std::shared_ptr<ICommand> cmd = recent.cmd;
+            QString text = recent.text;
+            entry.trigger = [cmd, ctx, text]() {
+                RecentCommands::GetInstance().record(cmd->commandId(), text, cmd);
+                cmd->executeAsync(ctx);
+            };
+            entries.push_back(entry);
+        }
+        addDynamicSection(menu, section, entries);
+    }
+
+    // 超长动态列表使用虚拟化子菜单，不为每个条目创建 QAction
+    void addVirtualListMenu(QMenu* menu, const QString& title, const VirtualListSource& source) {
+        QMenu* subMenu = new QMenu(title, menu);
+        QWidgetAction* action = new QWidgetAction(subMenu);
+        action->setDefaultWidget(new VirtualListPopup(source));
+        subMenu->addAction(action);
+        menu->addMenu(subMenu);
+    }
+};
+
+// 基础菜单装饰器，增加“复制剪切粘贴”等基础操作
+class BaseMenuDecorator : public BuiltinMenuStrategy {
+public:
+    BaseMenuDecorator(std::shared_ptr<MenuStrategy> wrapped)
+        : wrappedStrategy(std::move(wrapped)) {}
+
+    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
+        QMenu* menu = nullptr;
+        if (wrappedStrategy) {
+            menu = wrappedStrategy->createMenu(parent, ctx);
+        } else {
+            menu = new QMenu(parent);
+        }
+        // 添加基础菜单项
+        menu->addSeparator();
+        addCommandAction(menu, "复制", std::make_shared<CopyCommand>(), ctx);
+        addCommandAction(menu, "剪切", std::make_shared<CutCommand>(), ctx);
+        addCommandAction(menu, "粘贴", std::make_shared<PasteCommand>(), ctx);
+        addCommandAction(menu, "创建副本", std::make_shared<DuplicateCommand>(), ctx);
+
+        QMenu* orderMenu = new QMenu("排列", menu);
+        addCommandAction(orderMenu, "置于顶层", std::make_shared<ZOrderCommand>(ZOrderCommand::BringToFront), ctx);
+        addCommandAction(orderMenu, "置于底层", std::make_shared<ZOrderCommand>(ZOrderCommand::SendToBack), ctx);
+        addCommandAction(orderMenu, "上移一层", std::make_shared<ZOrderCommand>(ZOrderCommand::MoveUp), ctx);
+        addCommandAction(orderMenu, "下移一层", std::make_shared<ZOrderCommand>(ZOrderCommand::MoveDown), ctx);
+        menu->addMenu(orderMenu);
+        addCommandAction(menu, "组合", std::make_shared<GroupCommand>(), ctx);
+        return menu;
+    }
+
+private:
+    std::shared_ptr<MenuStrategy> wrappedStrategy;
+};
+
+// 组合菜单策略，基础菜单由装饰器提供
+class GroupMenuStrategy : public BuiltinMenuStrategy {
+public:
+    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
+        QMenu* menu = new QMenu(parent);
+        addCommandAction(menu, "取消组合", std::make_shared<UngroupCommand>(), ctx);
+        return menu;
+    }
+};
+
+class PasteOnlyMenuDecorator : public BuiltinMenuStrategy {
+public:
+    PasteOnlyMenuDecorator(std::shared_ptr<MenuStrategy> wrapped)
+        : wrappedStrategy(std::move(wrapped)) {}
+
+    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
+        QMenu* menu = nullptr;
+        if (wrappedStrategy) {
+            menu = wrappedStrategy->createMenu(parent, ctx);
+        } else {
+            menu = new QMenu(parent);
+        }
+
+        menu->addSeparator();
+        addCommandAction(menu, "粘贴", ctx);
+        return menu;
+    }
+
+private:
+    std::shared_ptr<MenuStrategy> wrappedStrategy;
+};
+
+// 文本菜单策略 (基础菜单 + 特殊菜单)
+class TextItemMenuStrategy : public BuiltinMenuStrategy {
+public:
+    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
+        QMenu* menu = new QMenu(parent);
+        addCommandAction(menu, "编辑文本", std::make_shared<EditTextCommand>(), ctx);
+        addCommandAction(menu, "改变字体", std::make_shared<ChangeFontCommand>(), ctx);
+        return menu;
+    }
+};
+
+// 背景菜单策略 (基础菜单 + 特殊菜单)
+class BackgroundMenuStrategy : public BuiltinMenuStrategy {
+public:
+    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
+        QMenu* menu = new QMenu(parent);
+        addCommandAction(menu, "添加幻灯片", CommandRegistry::GetInstance().create("addSlide"), ctx);
+        QMenu* layoutMenu = new QMenu("版式布局", menu);
+        addCommandAction(layoutMenu, "网格", std::make_shared<LayoutCommand>(LayoutState::Grid), ctx);
+        addCommandAction(layoutMenu, "流式", std::make_shared<LayoutCommand>(LayoutState::Flow), ctx);
+        addCommandAction(layoutMenu, "对齐参考线", std::make_shared<LayoutCommand>(LayoutState::Align), ctx);
+        menu->addMenu(layoutMenu);
+        addCommandAction(menu, "导出图像", std::make_shared<ExportImageCommand>(), ctx);
+        if (ctx->scene) {
+            addVirtualListMenu(menu, "选择图元", itemListSource(ctx->scene));
+        }
+        addRecentCommandsSection(menu, ctx);
+        return menu;
+    }
+
+private:
+    // 场景中的全部图元，直接按下标访问场景的图元列表（无序，不收集不排序），打开子菜单的代价与图元数无关
+    // 列表打开期间图元可能增删，下标越界时忽略
+    static VirtualListSource itemListSource(QGraphicsScene* scene) {
+        QPointer<QGraphicsScene> guard(scene);
+        auto itemAt = [guard](int index) -> BaseCustomItem* {
+            SceneItemList* list = guard ? SceneItemList::find(guard) : nullptr;
+            return list && index >= 0 && index < list->size() ? list->at(index) : nullptr;
+        };
+
+        VirtualListSource source;
+        source.count = [guard]() -> int {
+            return guard ? SceneItemList::count(guard) : 0;
+        };
+        source.text = [itemAt](int index) {
+            BaseCustomItem* item = itemAt(index);
+            return item ? QString("%1 #%2").arg(item->objectType()).arg(item->id()) : QString();
+        };
+        source.activate = [itemAt, guard](int index) {
+            BaseCustomItem* item = itemAt(index);
+            if (!item) return;
+            guard->clearSelection();
+            item->setSelected(true);
+            for (QGraphicsView* view : guard->views()) {
+                view->ensureVisible(item);
+            }
+        };
+        return source;
+    }
+};
+
+// 椭圆菜单策略 (基础菜单 + 特殊菜单)
+class CircleMenuStrategy : public BuiltinMenuStrategy {
+public:
+    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
+        QMenu* menu = new QMenu(parent);
+        addCommandAction(menu, "改变颜色", std::make_shared<RecolorSelectionCommand>(), ctx);
+        addCommandAction(menu, "改变同类颜色", std::make_shared<RecolorTypeCommand>(), ctx);
+        addCommandAction(menu, "改变大小", std::make_shared<ResizeAllCommand>(), ctx);
+
+        // 二级菜单
+        QMenu* subMenu = new QMenu("图形属性", menu);
+        addCommandAction(subMenu, "旋转", std::make_shared<RotateSelectionCommand>(), ctx);
+        addCommandAction(subMenu, "缩放", std::make_shared<ScaleSelectionCommand>(), ctx);
+
+        menu->addMenu(subMenu);
+        return menu;
+    }
+};
+
+
+//*******************************************************************************************/
+// 工厂
+//*******************************************************************************************/
+// 菜单策略工厂注册器
+// 注册表以不可变快照发布（RCU）：读取只有原子读写，不加任何锁，任意线程都可查找；注册时复制当前快照、修改后原子替换
+// 旧快照用危险指针回收：读者查找期间在本线程的槽位中登记所用快照，发布时释放没有登记的旧快照；批量注册可减少复制次数
+// 类型可声明父类型与类别，查找顺序：精确类型 -> 父类型链 -> 类别 -> "Background"，
+// 发布快照时预先展开为直接查找表，弹出菜单时只需一次哈希查找
+class MenuStrategyFactory {
+public:
+    using Creator = std::function<std::shared_ptr<MenuStrategy>()>;
+
+    // 单例
+    static MenuStrategyFactory& GetInstance() {
+        static MenuStrategyFactory factory;
+        return factory;
+    }
+
+    void registerCreator(const QString& type, Creator creator) {
+        QVector<QPair<QString, Creator>> list;
+        list.append(qMakePair(type, std::move(creator)));
+        registerCreators(list);
+    }
+
+    // 一次发布一个新快照
+    void registerCreators(const QVector<QPair<QString, Creator>>& list) {
+        publish([&list](Registry& registry) {
+            for (const auto& entry : list) {
+                registry.creators.insert(entry.first, entry.second);
+            }
+        });
+    }
+
+    // 整组替换一个来源（如某个菜单定义文件）注册的创建函数，上一组中有而这一组中没有的类型随之移除
+    // 来源注册的创建函数优先于代码注册的同名创建函数，移除后恢复代码注册的菜单
+    void replaceCreators(const QString& source, const QVector<QPair<QString, Creator>>& list) {
+        publish([&](Registry& registry) {
+            QHash<QString, Creator>& layer = registry.layers[source];
+            layer.clear();
+            for (const auto& entry : list) {
+                layer.insert(entry.first, entry.second);
+            }
+        });
+    }
+
+    struct TypeDeclaration {
+        QString type;
+        QString parent;
+        QString category;
+    };
+
+    // 声明类型层次，未注册策略的子类型自动沿用父类型或类别的菜单
+    void declareType(const QString& type, const QString& parent, const QString& category = QString()) {
+        declareTypes({ TypeDeclaration{ type, parent, category } });
+    }
+
+    // 每次发布都要重新展开全部类型，启动时应一次声明所有类型
+    void declareTypes(const QVector<TypeDeclaration>& list) {
+        publish([&list](Registry& registry) {
+            for (const TypeDeclaration& declaration : list) {
+                TypeDecl decl;
+                decl.parent = declaration.parent;
+                decl.category = declaration.category;
+                registry.types.insert(declaration.type, decl);
+            }
+        });
+    }
+
+    std::shared_ptr<MenuStrategy> create(const QString& type) const {
+        Creator creator;
+        {
+            HazardGuard guard(localSlot());
+            const Registry* registry = guard.protect(current);
+            auto it = registry->resolved.constFind(type);
+            creator = it != registry->resolved.constEnd() ? it.value() : registry->fallback;
+        }
+        // 放开快照后再创建，创建函数中可以再次查找
+        return creator ? creator() : nullptr;
+    }
+
+    // 尚未回收的旧快照数，供测试检查回收
+    size_t retiredSnapshots() const {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        return retired.size();
+    }
+
+private:
+    struct TypeDecl {
+        QString parent;
+        QString category;
+    };
+
+    struct Registry {
+        QHash<QString, Creator> creators;
+        QMap<QString, QHash<QString, Creator>> layers;     // 按来源整组替换的创建函数
+        QHash<QString, Creator> effective;                  // 合并来源后的创建函数
+        QHash<QString, TypeDecl> types;
+        QHash<QString, Creator> resolved;   // 展开后的直接查找表
+        Creator fallback;                   // 未声明类型使用 "Background"
+    };
+
+    // 每个查找过的线程占用一个槽位，线程结束时归还供后来的线程复用；槽位只增不减，数量不超过同时查找的线程数
+    struct HazardSlot {
+        std::atomic<const Registry*> registry{nullptr};
+        std::atomic<bool> used{false};
+        HazardSlot* next = nullptr;
+    };
+
+    // 线程局部，线程结束时归还槽位
+    struct SlotOwner {
+        HazardSlot* slot = nullptr;
+        ~SlotOwner() {
+            if (slot) slot->used.store(false, std::memory_order_release);
+        }
+    };
+
+    class HazardGuard {
+    public:
+        explicit HazardGuard(HazardSlot* slot) : slot(slot) {}
+        ~HazardGuard() { slot->registry.store(nullptr, std::memory_order_release); }
+
+        // 登记后重读，确认快照在登记时仍是当前快照，此后发布者不会释放它
+        const Registry* protect(const std::atomic<const Registry*>& source) {
+            const Registry* registry = source.load(std::memory_order_acquire);
+            for (;;) {
+                slot->registry.store(registry, std::memory_order_seq_cst);
+                const Registry* again = source.load(std::memory_order_seq_cst);
+                if (again == registry) return registry;
+                registry = again;
+            }
+        }
+
+    private:
+        HazardSlot* slot;
+    };
+
+    MenuStrategyFactory() : current(new Registry()) {}
+
+    // 槽位可能在工厂析构后才由退出的线程归还，不释放
+    ~MenuStrategyFactory() {
+        delete current.load();
+        qDeleteAll(retired);
+    }
+
+    // 取空闲槽位或新建一个挂到表头，均为无锁操作，每个线程只做一次
+    HazardSlot* localSlot() const {
+        thread_local SlotOwner owner;
+        if (owner.slot) return owner.slot;
+        for (HazardSlot* slot = slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+            bool expected = false;
+            if (!slot->used.load(std::memory_order_relaxed) && slot->used.compare_exchange_strong(expected, true)) {
+                owner.slot = slot;
+                return slot;
+            }
+        }
+        HazardSlot* slot = new HazardSlot();
+        slot->used.store(true, std::memory_order_relaxed);
+        slot->next = slots.load(std::memory_order_relaxed);
+        while (!slots.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {}
+        owner.slot = slot;
+        return slot;
+    }
+
+    void publish(const std::function<void(Registry&)>& mutate) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        Registry* next = new Registry(*current.load(std::memory_order_relaxed));
+        mutate(*next);
+        flatten(*next);
+        retired.push_back(current.exchange(next, std::memory_order_seq_cst));
+        reclaim();
+    }
+
+    // 释放没有读者登记的旧快照，仍被登记的留到下次发布再检查
+    void reclaim() {
+        QSet<const Registry*> inUse;
+        for (HazardSlot* slot = slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+            if (const Registry* registry = slot->registry.load(std::memory_order_seq_cst)) inUse.insert(registry);
+        }
+        std::vector<const Registry*> kept;
+        for (const Registry* registry : retired) {
+            if (inUse.contains(registry)) kept.push_back(registry);
+            else delete registry;
+        }
+        retired.swap(kept);
+    }
+
+    static void flatten(Registry& registry) {
+        registry.effective = registry.creators;
+        for (const QHash<QString, Creator>& layer : registry.layers) {
+            for (auto it = layer.constBegin(); it != layer.constEnd(); ++it) registry.effective.insert(it.key(), it.value());
+        }
+        registry.fallback = registry.effective.value("Background");
+        registry.resolved.clear();
+
+        QSet<QString> names;
+        for (auto it = registry.effective.constBegin(); it != registry.effective.constEnd(); ++it) names.insert(it.key());
+        for (auto it = registry.types.constBegin(); it != registry.types.constEnd(); ++it) names.insert(it.key());
+
+        for (const QString& name : names) {
+            registry.resolved.insert(name, resolve(registry, name));
+        }
+    }
+
+    static Creator resolve(const Registry& registry, const QString& type) {
+        // 父类型链，防止声明成环
+        QString category;
+        QSet<QString> visited;
+        for (QString t = type; !t.isEmpty() && !visited.contains(t); ) {
+            visited.insert(t);
+            auto creator = registry.effective.constFind(t);
+            if (creator != registry.effective.constEnd()) return creator.value();
+
+            TypeDecl decl = registry.types.value(t);
+            if (category.isEmpty()) category = decl.category;   // 取最近祖先声明的类别
+            t = decl.parent;
+        }
+
+        if (!category.isEmpty()) {
+            auto creator = registry.effective.constFind(category);
+            if (creator != registry.effective.constEnd()) return creator.value();
+        }
+        return registry.fallback;
+    }
+
+    std::atomic<const Registry*> current;
+    mutable std::atomic<HazardSlot*> slots{nullptr};
+    std::vector<const Registry*> retired;       // 已被替换、可能仍有读者的快照，只在写锁内访问
+    mutable std::mutex writeMutex;
+};
+
+
+//*******************************************************************************************/
+// 声明式菜单定义
+//*******************************************************************************************/
+// JSON 菜单定义，首次加载时编译为二进制缓存，之后启动直接 mmap 缓存；文件变化时热重载
+// {
+//   "TextItem": { "decorator": "base", "entries": [
+//       { "text": "编辑文本", "command": "null" },
+//       { "separator": true },
+//       { "text": "图形属性", "entries": [ { "text": "旋转", "command": ["custom1", "custom2"] } ] }
+//   ] }
+// }
+// decorator: "base" 基础菜单装饰，"pasteOnly" 仅粘贴，"none" 不装饰
+// 定义覆盖同名类型的内置策略；虚拟列表、动态分组（如背景菜单的"选择图元"、"最近命令"）只能由代码提供，
+// 含这些内容的类型不应在定义中出现，否则会被整体替换掉
+namespace MenuDefinitionFormat {
+const quint32 kVersion = 1;
+
+enum NodeKind : quint32 { Action = 0, Submenu = 1, Separator = 2 };
+enum Decorator : quint32 { NoDecorator = 0, BaseDecorator = 1, PasteOnlyDecorator = 2 };
+
+struct Header {
+    char magic[4];          // "CMDF"
+    quint32 version;
+    qint64 sourceSize;      // 源JSON大小与修改时间，用于判断缓存是否过期
+    qint64 sourceMtime;
+    quint32 typeCount;
+    quint32 nodeCount;
+    quint32 cmdRefCount;
+    quint32 stringCount;
+    quint32 stringUnits;    // UTF-16 字符池长度
+    quint32 reserved;
+};
+
+struct TypeRecord {
+    quint32 name;           // 字符串索引
+    quint32 decorator;
+    quint32 firstNode;
+    quint32 nodeCount;
+};
+
+// 节点按前序排列，子树紧随父节点之后
+struct NodeRecord {
+    quint32 kind;
+    quint32 text;
+    quint32 subtreeSize;    // 含自身
+    quint32 firstCmd;
+    quint32 cmdCount;
+};
+
+struct StringRecord {
+    quint32 offset;
+    quint32 length;
+};
+}
+
+// 编译后的菜单定义，数据来自 mmap 的缓存文件或内存缓冲
+class MenuDefinitionCache {
+public:
+    using Header = MenuDefinitionFormat::Header;
+    using TypeRecord = MenuDefinitionFormat::TypeRecord;
+    using NodeRecord = MenuDefinitionFormat::NodeRecord;
+    using StringRecord = MenuDefinitionFormat::StringRecord;
+
+    ~MenuDefinitionCache() {
+        if (file && mapped) file->unmap(mapped);
+    }
+
+    // 映射缓存文件，源文件已变化或格式不符时返回空
+    static std::shared_ptr<MenuDefinitionCache> map(const QString& cachePath, const QFileInfo& source) {
+        std::shared_ptr<MenuDefinitionCache> cache(new MenuDefinitionCache());
+        cache->file.reset(new QFile(cachePath));
+        if (!cache->file->open(QIODevice::ReadOnly)) return nullptr;
+        qint64 size = cache->file->size();
+        if (size < qint64(sizeof(Header))) return nullptr;
+        cache->mapped = cache->file->map(0, size);
+        if (!cache->mapped) return nullptr;
+        if (!cache->attach(cache->mapped, size)) return nullptr;
+        if (cache->header->sourceSize != source.size()
+            || cache->header->sourceMtime != source.lastModified().toMSecsSinceEpoch()) {
+            return nullptr;
+        }
+        return cache;
+    }
+
+    // 缓存不可写时直接使用内存中的编译结果
+    static std::shared_ptr<MenuDefinitionCache> fromBuffer(const QByteArray& data) {
+        std::shared_ptr<MenuDefinitionCache> cache(new MenuDefinitionCache());
+        cache->buffer = data;
+        if (!cache->attach(reinterpret_cast<const uchar*>(cache->buffer.constData()), cache->buffer.size())) {
+            return nullptr;
+        }
+        return cache;
+    }
+
+    quint32 typeCount() const { return header->typeCount; }
+    const TypeRecord& type(quint32 index) const { return types[index]; }
+    const NodeRecord& node(quint32 index) const { return nodes[index]; }
+    quint32 commandRef(quint32 index) const { return cmdRefs[index]; }
+
+    QString string(quint32 index) const {
+        const StringRecord& record = strings[index];
+        return QString(reinterpret_cast<const QChar*>(pool + record.offset), int(record.length));
+    }
+
+private:
+    MenuDefinitionCache() = default;
+
+    // 校验整体大小与全部下标，之后的访问不再逐次检查
+    bool attach(const uchar* data, qint64 size) {
+        if (size < qint64(sizeof(Header))) return false;
+        header = reinterpret_cast<const Header*>(data);
+        if (qstrncmp(header->magic, "CMDF", 4) != 0 || header->version != MenuDefinitionFormat::kVersion) {
+            return false;
+        }
+        qint64 expected = qint64(sizeof(Header))
+                + qint64(header->typeCount) * sizeof(TypeRecord)
+                + qint64(header->nodeCount) * sizeof(NodeRecord)
+                + qint64(header->cmdRefCount) * sizeof(quint32)
+                + qint64(header->stringCount) * sizeof(StringRecord)
+                + qint64(header->stringUnits) * sizeof(ushort);
+        if (expected != size) return false;
+
+        const uchar* p = data + sizeof(Header);
+        types = reinterpret_cast<const TypeRecord*>(p);
+        p += header->typeCount * sizeof(TypeRecord);
+        nodes = reinterpret_cast<const NodeRecord*>(p);
+        p += header->nodeCount * sizeof(NodeRecord);
+        cmdRefs = reinterpret_cast<const quint32*>(p);
+        p += header->cmdRefCount * sizeof(quint32);
+        strings = reinterpret_cast<const StringRecord*>(p);
+        p += header->stringCount * sizeof(StringRecord);
+        pool = reinterpret_cast<const ushort*>(p);
+        return validate();
+    }
+
+    // 缓存文件可能损坏或被截断后恰好大小相符，记录中的下标都要落在各自的表内
+    bool validate() const {
+        const qint64 nodeCount = header->nodeCount;
+        const qint64 stringCount = header->stringCount;
+        for (quint32 i = 0; i < header->typeCount; ++i) {
+            const TypeRecord& type = types[i];
+            if (type.name >= stringCount || qint64(type.firstNode) + type.nodeCount > nodeCount) return false;
+        }
+        for (quint32 i = 0; i < header->nodeCount; ++i) {
+            const NodeRecord& node = nodes[i];
+            if (node.text >= stringCount || node.subtreeSize == 0 || qint64(i) + node.subtreeSize > nodeCount) return false;
+            if (node.kind == MenuDefinitionFormat::Action
+                && qint64(node.firstCmd) + node.cmdCount > qint64(header->cmdRefCount)) {
+                return false;
+            }
+        }
+        for (quint32 i = 0; i < header->cmdRefCount; ++i) {
+            if (cmdRefs[i] >= stringCount) return false;
+        }
+        for (quint32 i = 0; i < header->stringCount; ++i) {
+            if (qint64(strings[i].offset) + strings[i].length > qint64(header->stringUnits)) return false;
+        }
+        return true;
+    }
+
+    std::unique_ptr<QFile> file;
+    uchar* mapped = nullptr;
+    QByteArray buffer;
+
+    const Header* header = nullptr;
+    const TypeRecord* types = nullptr;
+    const NodeRecord* nodes = nullptr;
+    const quint32* cmdRefs = nullptr;
+    const StringRecord* strings = nullptr;
+    const ushort* pool = nullptr;
+};
+
+// JSON -> 二进制缓存
+class MenuDefinitionCompiler {
+public:
+    QByteArray compile(const QJsonObject& root, const QFileInfo& source) {
+        using namespace MenuDefinitionFormat;
+
+        for (auto it = root.constBegin(); it != root.constEnd(); ++it) {
+            QJsonObject def = it.value().toObject();
+            TypeRecord type;
+            type.name = intern(it.key());
+            QString decorator = def.value("decorator").toString("base");
+            type.decorator = decorator == "none" ? NoDecorator
+                           : decorator == "pasteOnly" ? PasteOnlyDecorator : BaseDecorator;
+            type.firstNode = quint32(nodes.size());
+            compileEntries(def.value("entries").toArray());
+            type.nodeCount = quint32(nodes.size()) - type.firstNode;
+            types.push_back(type);
+        }
+
+        Header header;
+        memcpy(header.magic, "CMDF", 4);
+        header.version = kVersion;
+        header.sourceSize = source.size();
+        header.sourceMtime = source.lastModified().toMSecsSinceEpoch();
+        header.typeCount = quint32(types.size());
+        header.nodeCount = quint32(nodes.size());
+        header.cmdRefCount = quint32(cmdRefs.size());
+        header.stringCount = quint32(strings.size());
+        header.stringUnits = quint32(pool.size());
+        header.reserved = 0;
+
+        QByteArray out;
+        out.reserve(int(sizeof(Header) + types.size() * sizeof(TypeRecord) + nodes.size() * sizeof(NodeRecord)
+                         + cmdRefs.size() * sizeof(quint32) + strings.size() * sizeof(StringRecord)
+                         + pool.size() * sizeof(QChar)));
+        out.append(reinterpret_cast<const char*>(&header), sizeof(Header));
+        append(out, types);
+        append(out, nodes);
+        append(out, cmdRefs);
+        append(out, strings);
+        out.append(reinterpret_cast<const char*>(pool.constData()), pool.size() * int(sizeof(QChar)));
+        return out;
+    }
+
+private:
+    template <typename T>
+    static void append(QByteArray& out, const std::vector<T>& records) {
+        if (!records.empty()) {
+            out.append(reinterpret_cast<const char*>(records.data()), int(records.size() * sizeof(T)));
+        }
+    }
+
+    quint32 intern(const QString& text) {
+        auto it = stringIndex.constFind(text);
+        if (it != stringIndex.constEnd()) return it.value();
+
+        MenuDefinitionFormat::StringRecord record;
+        record.offset = quint32(pool.size());
+        record.length = quint32(text.size());
+        pool.append(text);
+        quint32 index = quint32(strings.size());
+        strings.push_back(record);
+        stringIndex.insert(text, index);
+        return index;
+    }
+
+    void compileEntries(const QJsonArray& entries) {
+        for (const QJsonValue& value : entries) {
+            compileEntry(value.toObject());
+        }
+    }
+
+    void compileEntry(const QJsonObject& entry) {
+        using namespace MenuDefinitionFormat;
+
+        size_t index = nodes.size();
+        nodes.push_back(NodeRecord());
+        NodeRecord node = NodeRecord();
+        node.text = intern(entry.value("text").toString());
+        node.firstCmd = quint32(cmdRefs.size());
+
+        if (entry.value("separator").toBool()) {
+            node.kind = Separator;
+        } else if (entry.contains("entries")) {
+            node.kind = Submenu;
+            compileEntries(entry.value("entries").toArray());
+        } else {
+            node.kind = Action;
+            QJsonValue command = entry.value("command");
+            if (command.isArray()) {
+                for (const QJsonValue& id : command.toArray()) {
+                    cmdRefs.push_back(intern(id.toString()));
+                }
+            } else if (command.isString()) {
+                cmdRefs.push_back(intern(command.toString()));
+            }
+        }
+        node.cmdCount = node.kind == Action ? quint32(cmdRefs.size()) - node.firstCmd : 0;
+        node.subtreeSize = quint32(nodes.size() - index);
+        nodes[index] = node;
+    }
+
+    std::vector<MenuDefinitionFormat::TypeRecord> types;
+    std::vector<MenuDefinitionFormat::NodeRecord> nodes;
+    std::vector<quint32> cmdRefs;
+    std::vector<MenuDefinitionFormat::StringRecord> strings;
+    QString pool;
+    QHash<QString, quint32> stringIndex;
+};
+
+// 由编译后的定义生成菜单，持有缓存引用，热重载后旧菜单仍可安全使用
+class DeclarativeMenuStrategy : public BuiltinMenuStrategy {
+public:
+    DeclarativeMenuStrategy(std::shared_ptr<const MenuDefinitionCache> cache, quint32 typeIndex)
+        : cache(std::move(cache)), typeIndex(typeIndex) {}
+
+    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
+        QMenu* menu = new QMenu(parent);
+        const MenuDefinitionFormat::TypeRecord& type = cache->type(typeIndex);
+        buildEntries(menu, type.firstNode, type.firstNode + type.nodeCount, ctx);
+        return menu;
+    }
+
+private:
+    void buildEntries(QMenu* menu, quint32 first, quint32 end, CmdCtxPtr ctx) {
+        for (quint32 i = first; i < end; ) {
+            const MenuDefinitionFormat::NodeRecord& node = cache->node(i);
+            switch (node.kind) {
+            case MenuDefinitionFormat::Separator:
+                menu->addSeparator();
+                break;
+            case MenuDefinitionFormat::Submenu: {
+                QMenu* subMenu = new QMenu(cache->string(node.text), menu);
+                buildEntries(subMenu, i + 1, i + node.subtreeSize, ctx);
+                menu->addMenu(subMenu);
+                break;
+            }
+            default:
+                addCommandAction(menu, cache->string(node.text), resolveCommand(node), ctx);
+                break;
+            }
+            i += node.subtreeSize;
+        }
+    }
+
+    std::shared_ptr<ICommand> resolveCommand(const MenuDefinitionFormat::NodeRecord& node) const {
+        CommandRegistry& registry = CommandRegistry::GetInstance();
+        if (node.cmdCount == 1) {
+            auto cmd = registry.create(cache->string(cache->commandRef(node.firstCmd)));
+            return cmd ? cmd : std::make_shared<NullCommand>();
+        }
+
+        auto combo = std::make_shared<CompositeCommand>();
+        for (quint32 i = 0; i < node.cmdCount; ++i) {
+            combo->addCommand(registry.create(cache->string(cache->commandRef(node.firstCmd + i))));
+        }
+        return combo;
+    }
+
+    std::shared_ptr<const MenuDefinitionCache> cache;
+    quint32 typeIndex;
+};
+
+// 加载菜单定义并注册到工厂，监视文件变化热重载
+class MenuDefinitionLoader {
+public:
+    MenuDefinitionLoader() {
+        QObject::connect(&watcher, &QFileSystemWatcher::fileChanged, [this](const QString& path) {
+            // 编辑器常以“写临时文件再替换”的方式保存，需重新加入监视
+            if (!watcher.files().contains(path) && QFile::exists(path)) {
+                watcher.addPath(path);
+            }
+            reload();
+        });
+    }
+
+    bool load(const QString& jsonPath) {
+        // 换用另一份定义时撤下旧文件注册的菜单
+        if (!sourcePath.isEmpty()) {
+            MenuStrategyFactory::GetInstance().replaceCreators(QFileInfo(sourcePath).absoluteFilePath(), {});
+        }
+        sourcePath = jsonPath;
+        if (!watcher.files().isEmpty()) watcher.removePaths(watcher.files());
+        watcher.addPath(jsonPath);
+        return reload();
+    }
+
+    bool reload() {
+        QFileInfo source(sourcePath);
+        if (!source.exists()) return false;
+
+        QString cachePath = source.absoluteFilePath() + ".bin";
+        std::shared_ptr<MenuDefinitionCache> cache = MenuDefinitionCache::map(cachePath, source);
+        if (!cache) {
+            cache = compile(source, cachePath);
+            if (!cache) return false;
+        }
+        registerStrategies(source.absoluteFilePath(), cache);
+        return true;
+    }
+
+private:
+    static std::shared_ptr<MenuDefinitionCache> compile(const QFileInfo& source, const QString& cachePath) {
+        QFile file(source.absoluteFilePath());
+        if (!file.open(QIODevice::ReadOnly)) return nullptr;
+
+        QJsonParseError error;
+        QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+        if (error.error != QJsonParseError::NoError || !doc.isObject()) {
+            qWarning() << "menu definition parse error:" << source.filePath() << error.errorString();
+            return nullptr;
+        }
+
+        QByteArray data = MenuDefinitionCompiler().compile(doc.object(), source);
+
+        QSaveFile out(cachePath);
+        if (out.open(QIODevice::WriteOnly) && out.write(data) == data.size() && out.commit()) {
+            auto cache = MenuDefinitionCache::map(cachePath, source);
+            if (cache) return cache;
+        }
+        return MenuDefinitionCache::fromBuffer(data);
+    }
+
+    static void registerStrategies(const QString& source, std::shared_ptr<const MenuDefinitionCache> cache) {
+        QVector<QPair<QString, MenuStrategyFactory::Creator>> creators;
+        for (quint32 i = 0; i < cache->typeCount(); ++i) {
+            const MenuDefinitionFormat::TypeRecord& type = cache->type(i);
+            quint32 decorator = type.decorator;
+            creators.append(qMakePair(cache->string(type.name), MenuStrategyFactory::Creator([cache, i, decorator]() -> std::shared_ptr<MenuStrategy> {
+                std::shared_ptr<MenuStrategy> strategy = std::make_shared<DeclarativeMenuStrategy>(cache, i);
+                if (decorator == MenuDefinitionFormat::BaseDecorator) {
+                    return std::make_shared<BaseMenuDecorator>(strategy);
+                }
+                if (decorator == MenuDefinitionFormat::PasteOnlyDecorator) {
+                    return std::make_shared<PasteOnlyMenuDecorator>(strategy);
+                }
+                return strategy;
+            })));
+        }
+        // 整份定义替换上一次的定义并作为一个快照发布：热重载时读者不会看到新旧混杂的注册表，
+        // 从文件中删掉的类型也不会残留旧菜单
+        MenuStrategyFactory::GetInstance().replaceCreators(source, creators);
+    }
+
+    QString sourcePath;
+    QFileSystemWatcher watcher;
+};
+
+
+//*******************************************************************************************/
+// 策略插件
+//*******************************************************************************************/
+// 宿主服务的实现：插件的命令项与内置策略一致，命令按ID从命令注册表创建
+class AppMenuHost : public MenuHost {
+public:
+    // 单例
+    static AppMenuHost& GetInstance() {
+        static AppMenuHost host;
+        return host;
+    }
+
+    void addCommandAction(QMenu* menu, const QString& text, std::shared_ptr<ICommand> cmd, CmdCtxPtr ctx) override {
+        BuiltinMenuStrategy::addCommandAction(menu, text, std::move(cmd), ctx);
+    }
+
+    std::shared_ptr<ICommand> createCommand(const QString& id) override {
+        return CommandRegistry::GetInstance().create(id);
+    }
+};
+
+// 按清单懒加载策略插件：启动时只读取清单并注册占位创建函数，
+// 某类型第一次弹出右键菜单时才加载对应插件；插件接口见 menu_strategy_plugin.h
+// 清单格式：{ "类型": "插件文件（相对清单目录，可省略平台相关的前缀与后缀）", ... }
+class PluginStrategyLoader {
+public:
+    bool load(const QString& manifestPath) {
+        QFile file(manifestPath);
+        if (!file.open(QIODevice::ReadOnly)) return false;
+
+        QJsonParseError error;
+        QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+        if (error.error != QJsonParseError::NoError || !doc.isObject()) {
+            qWarning() << "plugin manifest parse error:" << manifestPath << error.errorString();
+            return false;
+        }
+
+        QDir dir = QFileInfo(manifestPath).absoluteDir();
+        QHash<QString, std::shared_ptr<PluginHandle>> handles;
+        QVector<QPair<QString, MenuStrategyFactory::Creator>> creators;
+
+        QJsonObject manifest = doc.object();
+        for (auto it = manifest.constBegin(); it != manifest.constEnd(); ++it) {
+            QString pluginPath = dir.absoluteFilePath(it.value().toString());
+            std::shared_ptr<PluginHandle>& handle = handles[pluginPath];
+            if (!handle) {
+                handle = std::make_shared<PluginHandle>();
+                handle->path = pluginPath;
+            }
+
+            QString type = it.key();
+            std::shared_ptr<PluginHandle> captured = handle;
+            creators.append(qMakePair(type, MenuStrategyFactory::Creator([captured, type]() -> std::shared_ptr<MenuStrategy> {
+                MenuStrategyPlugin* plugin = captured->instance();
+                return plugin ? plugin->createStrategy(type, &AppMenuHost::GetInstance()) : nullptr;
+            })));
+        }
+        MenuStrategyFactory::GetInstance().registerCreators(creators);
+        return true;
+    }
+
+private:
+    // 同一插件文件的多个类型共享一个句柄，只加载一次
+    struct PluginHandle {
+        QString path;
+        std::mutex mutex;
+        std::unique_ptr<QPluginLoader> loader;
+        MenuStrategyPlugin* plugin = nullptr;
+        bool failed = false;
+
+        MenuStrategyPlugin* instance() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (plugin || failed) return plugin;
+
+            loader.reset(new QPluginLoader(path));
+            plugin = qobject_cast<MenuStrategyPlugin*>(loader->instance());
+            if (!plugin) {
+                qWarning() << "failed to load strategy plugin:" << path << loader->errorString();
+                failed = true;
+            }
+            return plugin;
+        }
+    };
+};
+
+
+//*******************************************************************************************/
+//场景
+//*******************************************************************************************/
+// Custom QGraphicsScene
+class CustomScene : public QGraphicsScene {
+public:
+    CustomScene() = default;
+
+protected:
+    void contextMenuEvent(QGraphicsSceneContextMenuEvent* event) override {
+        QGraphicsItem* item = itemAt(event->scenePos(), QTransform());
+        // 组合内的图元按其所在的最外层组合分派菜单，只沿父链上溯
+        if (item) item = item->topLevelItem();
+
+        if(item) {
+            BaseCustomItem* baseItem = dynamic_cast<BaseCustomItem*>(item);
+
+            // 转换成功
+            if (baseItem) {
+                auto strategy = MenuStrategyFactory::GetInstance().create(baseItem->objectType());
+                if (strategy) {
+                    CmdCtxPtr ctx = std::make_shared<CommandContext>();
+                    ctx->scene = this;
+                    ctx->item = baseItem;
+                    ctx->extras["selection"] = QVariant::fromValue(selectionFor(baseItem));
+                    ctx->extras["scenePos"] = event->scenePos();
+                    QMenu* menu = strategy->createMenu(nullptr, ctx);
+                    menu->exec(event->screenPos());
+                    delete menu;
+                    return;  // 菜单弹出后返回，防止继续冒泡
+                }
+            }
+        }
+
+        auto defaultStrategy = MenuStrategyFactory::GetInstance().create("Background");
+        if (defaultStrategy) {
+            CmdCtxPtr ctx = std::make_shared<CommandContext>();
+            ctx->scene = this;
+            ctx->extras["scenePos"] = event->scenePos();
+            QMenu* menu = defaultStrategy->createMenu(nullptr, ctx);
+            menu->exec(event->screenPos());
+            delete menu;
+            return;
+        }
+
+        QGraphicsScene::contextMenuEvent(event);
+    }
+
+    // 右键的图元已选中时作用于全部选中图元，否则只作用于该图元
+    QList<BaseCustomItem*> selectionFor(BaseCustomItem* clicked) const {
+        QList<BaseCustomItem*> list;
+        if (!clicked->isSelected()) {
+            list << clicked;
+            return list;
+        }
+        for (QGraphicsItem* selected : selectedItems()) {
+            if (BaseCustomItem* baseItem = dynamic_cast<BaseCustomItem*>(selected)) {
+                list << baseItem;
+            }
+        }
+        return list;
+    }
+
+private:
+    std::shared_ptr<MenuStrategy> menuStrategy;
+};
+
+//*******************************************************************************************/
+// 幻灯片
+//*******************************************************************************************/
+// 多页文档：只有当前页及相邻页以场景形式常驻，其余页保存为剪贴板二进制格式
+// 场景是文档的子对象；翻页时先切换视图，相邻页的预载与远处页的换出延后到下一轮事件循环
+// 换出时图元归还对象池，换入时从对象池取出，翻页不反复分配图元
+// 撤销栈随场景释放，页面换出后其撤销历史不再保留
+class SlideDocument : public QObject {
+public:
+    using SceneChanged = std::function<void(CustomScene* scene, int index, int count)>;
+
+    // 接管已有场景作为第一页
+    explicit SlideDocument(CustomScene* first) {
+        first->setParent(this);
+        slides.push_back(Slide());
+        slides.back().scene = first;
+    }
+
+    // 场景所属的文档
+    static SlideDocument* of(QGraphicsScene* scene) {
+        return scene ? dynamic_cast<SlideDocument*>(scene->parent()) : nullptr;
+    }
 
-    // 控制对应的Action是否启用
-    virtual bool isEnable(CmdCtxPtr ctx) const {
-        return true;
+    void setSceneChangedCallback(SceneChanged callback) { onSceneChanged = std::move(callback); }
+
+    int count() const { return int(slides.size()); }
+    int currentIndex() const { return current; }
+
+    // 在 index 处插入空白页，返回其序号
+    int insertSlide(int index) {
+        index = qBound(0, index, count());
+        slides.insert(slides.begin() + index, Slide());
+        if (index <= current && count() > 1) ++current;
+        return index;
     }
 
-    // 控制对应的Action是否显示
-    virtual bool isVisible(CmdCtxPtr ctx) const {
-        return true;
+    void show(int index) {
+        if (index < 0 || index >= count()) return;
+        current = index;
+        CustomScene* scene = materialize(index);
+        if (onSceneChanged) onSceneChanged(scene, current, count());
+        scheduleTrim();
     }
-};
 
-// 组合命令(为了以后扩展)
-class CompositeCommand : public ICommand {
-public:
-    void addCommand(std::shared_ptr<ICommand> cmd) {
-        if(cmd) commands.push_back(std::move(cmd));
+    // 固定的页面不换出，供流式加载等持有场景指针的长任务使用
+    void setPinned(QGraphicsScene* scene, bool pinned) {
+        for (Slide& slide : slides) {
+            if (slide.scene != scene) continue;
+            slide.pinned = pinned;
+            if (!pinned) scheduleTrim();
+            return;
+        }
     }
 
-    void execute(CmdCtxPtr ctx) override {
-        for (auto& cmd : commands) {
-            if(cmd) cmd->execute(ctx);
+    // 一页的保存内容：常驻页为快照（只复制指针与引用计数），换出页为其序列化数据（隐式共享）
+    struct SlideContent {
+        bool resident = false;
+        SceneSnapshot snapshot;
+        QByteArray payload;
+    };
+
+    // GUI线程调用，按页序返回全部页面
+    std::vector<SlideContent> contents() const {
+        std::vector<SlideContent> result(slides.size());
+        for (size_t i = 0; i < slides.size(); ++i) {
+            result[i].resident = slides[i].scene != nullptr;
+            if (slides[i].scene) result[i].snapshot = takeSnapshot(slides[i].scene);
+            else result[i].payload = slides[i].payload;
         }
+        return result;
     }
 
 private:
-    std::vector<std::shared_ptr<ICommand>> commands;
-};
+    struct Slide {
+        QByteArray payload;                 // 换出时的序列化数据，空页为空
+        CustomScene* scene = nullptr;       // 常驻时的场景
+        bool pinned = false;
+    };
 
-// 命令组合器，用于生成组合命令
-namespace CommandUtils {
-std::shared_ptr<ICommand> combineCommands(std::initializer_list<std::shared_ptr<ICommand>> list) {
-    auto combo = std::make_shared<CompositeCommand>();
-    for (const auto& cmd : list) {
-        combo->addCommand(cmd);
+    void scheduleTrim() {
+        if (trimScheduled) return;
+        trimScheduled = true;
+        QTimer::singleShot(0, this, [this]() {
+            trimScheduled = false;
+            trimResident();
+        });
     }
-    return combo;
-}
-}
 
-// 复制命令
-class CopyCommand : public ICommand {
-public:
-    void execute(CmdCtxPtr ctx) override {
-        // 选中的对象可能是多个
-        auto list = ctx->extras.value("selection").value<QList<BaseCustomItem*>>();
-        for (BaseCustomItem* item : list) {
-            if (item) item->copy();
+    CustomScene* materialize(int index) {
+        Slide& slide = slides[size_t(index)];
+        if (slide.scene) return slide.scene;
+
+        slide.scene = new CustomScene();
+        slide.scene->setParent(this);
+        if (!slide.payload.isEmpty()) {
+            ItemPayloadReader reader(slide.payload);
+            std::vector<ItemRecord> records;
+            records.reserve(reader.count());
+            ItemRecord record;
+            while (reader.next(record)) {
+                records.push_back(record);
+            }
+            insertRecords(slide.scene, records, QPointF());
+            slide.payload.clear();
         }
+        return slide.scene;
     }
-};
 
-// 粘贴命令
-class PasteCommand : public ICommand {
-public:
-    void execute(CmdCtxPtr ctx) override {
-        QClipboard* clipboard = QApplication::clipboard();
-        QMessageBox::information(nullptr, "paste", clipboard->text());
+    void evict(int index) {
+        Slide& slide = slides[size_t(index)];
+        if (!slide.scene || slide.pinned) return;
+
+        // 升序保存，换入时按原有叠放次序插入
+        QList<BaseCustomItem*> items;
+        for (QGraphicsItem* item : slide.scene->items(Qt::AscendingOrder)) {
+            if (item->parentItem()) continue;   // 组合内的图元随组合一起保存
+            if (BaseCustomItem* baseItem = dynamic_cast<BaseCustomItem*>(item)) items << baseItem;
+        }
+        slide.payload = items.isEmpty() ? QByteArray() : ItemClipboard::encode(items);
+        {
+            SceneIndexSuspender suspender(slide.scene, SceneItemList::count(slide.scene));
+            for (BaseCustomItem* item : items) {
+                slide.scene->removeItem(item);
+                ItemPool::GetInstance().release(item);
+            }
+        }
+        delete slide.scene;
+        slide.scene = nullptr;
     }
 
-    virtual bool isEnable(CmdCtxPtr ctx) const override {
-        QClipboard* clipboard = QApplication::clipboard();
-        return !clipboard->text().isEmpty();
-        // return false;
+    // 预载相邻页，换出范围外的页
+    void trimResident() {
+        for (int i = 0; i < count(); ++i) {
+            if (qAbs(i - current) <= kNeighbours) {
+                materialize(i);
+            } else {
+                evict(i);
+            }
+        }
     }
+
+    static const int kNeighbours = 1;
+
+    std::vector<Slide> slides;
+    int current = 0;
+    bool trimScheduled = false;
+    SceneChanged onSceneChanged;
 };
 
-// 空命令，什么也不做
-class NullCommand : public ICommand {
+QObject* documentOf(QGraphicsScene* scene) {
+    if (SlideDocument* document = SlideDocument::of(scene)) return document;
+    return scene;
+}
+
+// 添加幻灯片命令，在当前页之后插入空白页并切换过去
+class AddSlideCommand : public ICommand {
 public:
-    void execute(CmdCtxPtr ctx) override {
-        // do nothing
+    QString commandId() const override {
+        return "addSlide";
     }
-};
 
-// 自定义命令1
-class CustomCommand1 : public ICommand {
-public:
     void execute(CmdCtxPtr ctx) override {
-        qDebug() << "CustomCommand1 executed";
+        SlideDocument* document = SlideDocument::of(ctx->scene);
+        if (!document) return;
+        document->show(document->insertSlide(document->currentIndex() + 1));
     }
-};
 
-// 自定义命令2
-class CustomCommand2 : public ICommand {
-public:
-    void execute(CmdCtxPtr ctx) override {
-        qDebug() << "CustomCommand2 executed";
+    bool isEnable(CmdCtxPtr ctx) const override {
+        return SlideDocument::of(ctx->scene) != nullptr;
     }
 };
 
-
 //*******************************************************************************************/
-// 右键菜单
+//流式加载
 //*******************************************************************************************/
-// 策略接口
-class MenuStrategy {
+// 工作线程解析文件，GUI线程按时间片分块插入场景，加载期间已插入的图元可正常弹出右键菜单
+// 文件格式：每行 "类型 x y"，以 # 开头的行为注释
+class StreamingSceneLoader {
 public:
-    virtual ~MenuStrategy() = default;
-    virtual QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) = 0;
-
-protected:
-    void addCommandAction(QMenu* menu, const QString& text,
-                          std::shared_ptr<ICommand> cmd,
-                          CmdCtxPtr ctx) {
-        if (!cmd || !cmd->isVisible(ctx)) return;
+    using ProgressCallback = std::function<void(qint64 done, qint64 total)>;
+    using FinishedCallback = std::function<void(bool cancelled)>;
 
-        auto* action = menu->addAction(text);
-        action->setEnabled(cmd->isEnable(ctx));
-        QObject::connect(action, &QAction::triggered, [cmd, ctx]() {
-            cmd->execute(ctx);
-        });
+    explicit StreamingSceneLoader(QGraphicsScene* scene, int frameBudgetMs = 8)
+        : scene(scene), frameBudgetMs(frameBudgetMs) {
+        QObject::connect(&timer, &QTimer::timeout, [this]() { insertChunk(); });
     }
 
-    void addCommandAction(QMenu* menu, const QString& text, CmdCtxPtr ctx) {
-        addCommandAction(menu, text, std::make_shared<NullCommand>(), ctx);
+    ~StreamingSceneLoader() {
+        cancel();
+        if (worker.joinable()) worker.join();
     }
-};
 
-// 基础菜单装饰器，增加“复制剪切粘贴”等基础操作
-class BaseMenuDecorator : public MenuStrategy {
-public:
-    BaseMenuDecorator(std::shared_ptr<MenuStrategy> wrapped)
-        : wrappedStrategy(std::move(wrapped)) {}
+    void setProgressCallback(ProgressCallback callback) { onProgress = std::move(callback); }
+    void setFinishedCallback(FinishedCallback callback) { onFinished = std::move(callback); }
 
-    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
-        QMenu* menu = nullptr;
-        if (wrappedStrategy) {
-            menu = wrappedStrategy->createMenu(parent, ctx);
-        } else {
-            menu = new QMenu(parent);
-        }
-        // 添加基础菜单项
-        menu->addSeparator();
-        addCommandAction(menu, "复制", std::make_shared<CopyCommand>(), ctx);
-        addCommandAction(menu, "剪切", ctx);
-        addCommandAction(menu, "粘贴", std::make_shared<PasteCommand>(), ctx);
-        return menu;
-    }
+    bool start(const QString& fileName) {
+        if (running || !scene) return false;
+        if (worker.joinable()) worker.join();
 
-private:
-    std::shared_ptr<MenuStrategy> wrappedStrategy;
-};
+        QFile probe(fileName);
+        if (!probe.exists()) return false;
+        totalBytes = probe.size();
 
-class PasteOnlyMenuDecorator : public MenuStrategy {
-public:
-    PasteOnlyMenuDecorator(std::shared_ptr<MenuStrategy> wrapped)
-        : wrappedStrategy(std::move(wrapped)) {}
+        queue.reset();
+        current = Batch();
+        currentIndex = 0;
+        running = true;
 
-    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
-        QMenu* menu = nullptr;
-        if (wrappedStrategy) {
-            menu = wrappedStrategy->createMenu(parent, ctx);
-        } else {
-            menu = new QMenu(parent);
-        }
+        suspender.reset(new SceneIndexSuspender(scene));
+        worker = std::thread(&StreamingSceneLoader::parse, this, fileName);
+        timer.start(0);
+        return true;
+    }
 
-        menu->addSeparator();
-        addCommandAction(menu, "粘贴", ctx);
-        return menu;
+    void cancel() {
+        queue.cancel();
+        if (running) finish();
     }
 
+    bool isRunning() const { return running; }
+
 private:
-    std::shared_ptr<MenuStrategy> wrappedStrategy;
-};
+    struct Record {
+        QString type;
+        QPointF pos;
+    };
 
-// 文本菜单策略 (基础菜单 + 特殊菜单)
-class TextItemMenuStrategy : public MenuStrategy {
-public:
-    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
-        QMenu* menu = new QMenu(parent);
-        addCommandAction(menu, "编辑文本", ctx);
-        addCommandAction(menu, "改变字体", ctx);
-        return menu;
-    }
-};
+    struct Batch {
+        std::vector<Record> records;
+        qint64 endOffset = 0;   // 该批解析结束时的文件偏移，用于进度
+    };
 
-// 背景菜单策略 (基础菜单 + 特殊菜单)
-class BackgroundMenuStrategy : public MenuStrategy {
-public:
-    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
-        QMenu* menu = new QMenu(parent);
-        addCommandAction(menu, "添加幻灯片", ctx);
-        addCommandAction(menu, "版式布局", ctx);
-        return menu;
-    }
-};
+    static const int kBatchSize = 4096;
 
-// 不支持基础菜单，只显示自己的菜单
-class NoBaseMenuStrategy : public MenuStrategy {
-public:
-    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
-        QMenu* menu = new QMenu(parent);
+    // 工作线程
+    void parse(QString fileName) {
+        QFile file(fileName);
+        if (file.open(QIODevice::ReadOnly)) {
+            Batch batch;
+            batch.records.reserve(kBatchSize);
+            while (!file.atEnd() && !queue.isCancelled()) {
+                QByteArray line = file.readLine().trimmed();
+                if (line.isEmpty() || line.startsWith('#')) continue;
 
-        auto combo = std::make_shared<CompositeCommand>();
-        combo->addCommand(std::make_shared<CustomCommand1>());
-        combo->addCommand(std::make_shared<CustomCommand2>());
+                QList<QByteArray> fields = line.simplified().split(' ');
+                if (fields.size() < 3) continue;
 
-        addCommandAction(menu, "无公共操作，仅特殊操作", combo, ctx);
-        return menu;
+                Record record;
+                record.type = QString::fromUtf8(fields[0]);
+                record.pos = QPointF(fields[1].toDouble(), fields[2].toDouble());
+                batch.records.push_back(std::move(record));
+
+                if (int(batch.records.size()) >= kBatchSize) {
+                    batch.endOffset = file.pos();
+                    if (!queue.push(std::move(batch))) break;
+                    batch = Batch();
+                    batch.records.reserve(kBatchSize);
+                }
+            }
+            if (!batch.records.empty()) {
+                batch.endOffset = file.pos();
+                queue.push(std::move(batch));
+            }
+        }
+        queue.close();
     }
-};
 
-// 椭圆菜单策略 (基础菜单 + 特殊菜单)
-class CircleMenuStrategy : public MenuStrategy {
-public:
-    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
-        QMenu* menu = new QMenu(parent);
-        addCommandAction(menu, "改变颜色", ctx);
-        addCommandAction(menu, "改变大小", ctx);
+    // GUI线程，每轮事件循环最多占用 frameBudgetMs 毫秒
+    void insertChunk() {
+        if (!scene) {
+            cancel();
+            return;
+        }
 
-        // 命令组合器使用
-        auto combo = CommandUtils::combineCommands({
-            std::make_shared<CustomCommand1>(),
-            std::make_shared<CustomCommand2>()
-        });
+        QElapsedTimer elapsed;
+        elapsed.start();
+        ItemFactory& factory = ItemFactory::GetInstance();
 
-        // 二级菜单
-        QMenu* subMenu = new QMenu("图形属性", menu);
-        addCommandAction(subMenu, "旋转", combo, ctx);
-        addCommandAction(subMenu, "缩放", ctx);
+        while (elapsed.elapsed() < frameBudgetMs) {
+            if (currentIndex >= current.records.size()) {
+                if (!queue.tryPop(current)) {
+                    if (queue.isDrained()) finish();
+                    return;   // 解析线程尚未跟上
+                }
+                currentIndex = 0;
+            }
 
-        menu->addMenu(subMenu);
-        return menu;
+            const Record& record = current.records[currentIndex++];
+            BaseCustomItem* item = factory.create(record.type);
+            if (item) {
+                item->setPos(record.pos);
+                scene->addItem(item);
+            }
+            if (currentIndex == current.records.size() && onProgress) {
+                onProgress(current.endOffset, totalBytes);
+            }
+        }
     }
-};
 
+    void finish() {
+        timer.stop();
+        running = false;
+        suspender.reset();  // 恢复索引，一次性批量建树
+        if (onFinished) onFinished(queue.isCancelled());
+    }
+
+    QPointer<QGraphicsScene> scene;
+    int frameBudgetMs;
+    QTimer timer;
+    std::thread worker;
+    std::unique_ptr<SceneIndexSuspender> suspender;
+    BatchQueue<Batch> queue;
+    bool running = false;
+
+    Batch current;
+    size_t currentIndex = 0;
+    qint64 totalBytes = 0;
+
+    ProgressCallback onProgress;
+    FinishedCallback onFinished;
+};
 
 //*******************************************************************************************/
-// 工厂
+//自动保存
 //*******************************************************************************************/
-// 菜单策略工厂注册器
-class MenuStrategyFactory {
+// 后台自动保存：GUI线程只取快照，序列化在工作线程完成，用户可继续编辑
+// 保存整个文档：常驻页按图元缓存已编码的记录，只重新编码上次保存后修改过的图元；换出页直接写入其序列化数据
+// 文件格式（小端）：magic "CMDS" u32 | version u16 | slideCount u16 | 每页 { length u32 | 剪贴板格式数据 }，空页长度为 0
+class AutosaveService {
 public:
-    using Creator = std::function<std::shared_ptr<MenuStrategy>()>;
+    static const quint32 kMagic = 0x53444d43;
+    static const quint16 kVersion = 1;
 
-    // 单例
-    static MenuStrategyFactory& GetInstance() {
-        static MenuStrategyFactory factory;
-        return factory;
+    AutosaveService(SlideDocument* document, const QString& path, int intervalMs = 60000)
+        : document(document), path(path) {
+        QObject::connect(&timer, &QTimer::timeout, [this]() { saveNow(); });
+        timer.start(intervalMs);
     }
 
-    void registerCreator(const QString& type, Creator creator) {
-        creators[type] = creator;
+    ~AutosaveService() {
+        if (worker.joinable()) worker.join();
     }
 
-    std::shared_ptr<MenuStrategy> create(const QString& type) {
-        if (creators.contains(type)) {
-            return creators[type]();
-        }
-        return nullptr;
+    void saveNow() {
+        if (!document || busy) return;
+        if (worker.joinable()) worker.join();
+        busy = true;
+        worker = std::thread(&AutosaveService::write, this, document->contents(), ColorPalette::GetInstance().generation());
     }
 
 private:
-    QMap<QString, Creator> creators;
-};
-
-
-//*******************************************************************************************/
-//场景
-//*******************************************************************************************/
-// Custom QGraphicsScene
-class CustomScene : public QGraphicsScene {
-public:
-    CustomScene() = default;
+    struct Chunk {
+        quint64 revision;
+        quint64 parent;
+        QByteArray bytes;
+    };
 
-protected:
-    void contextMenuEvent(QGraphicsSceneContextMenuEvent* event) override {
-        QGraphicsItem* item = itemAt(event->scenePos(), QTransform());
+    // 工作线程，chunks 与类型表只在这里访问
+    void write(std::vector<SlideDocument::SlideContent> slides, quint64 paletteGeneration) {
+        // 槽位颜色变化后已编码的颜色失效，全部重新编码
+        if (paletteGeneration != encodedGeneration) {
+            chunks.clear();
+            encodedGeneration = paletteGeneration;
+        }
+        QHash<quint64, Chunk> current;
+        std::vector<QByteArray> headers(slides.size());
 
+        for (size_t i = 0; i < slides.size(); ++i) {
+            const SceneSnapshot& snapshot = slides[i].snapshot;
+            if (!slides[i].resident || snapshot.empty()) continue;
+            QRectF bounds;
+            for (const ItemSnapshot& entry : snapshot) {
+                bounds |= entry.sceneRect();
+                auto cached = chunks.constFind(entry.id);
+                if (cached != chunks.constEnd() && cached.value().revision == entry.revision
+                    && cached.value().parent == entry.parent) {
+                    current.insert(entry.id, cached.value());
+                    continue;
+                }
 
-        // auto list = ctx.extras.value("selection").value<QList<BaseCustomItem*>>();
-        // for (BaseCustomItem* item : list) {
-        //     if (item) item->copy();
-        // }
+                Chunk chunk;
+                chunk.revision = entry.revision;
+                chunk.parent = entry.parent;
+                ItemClipboard::putRecord(chunk.bytes, typeIndexOf(entry.type), entry.pos, *entry.data, entry.id, entry.parent);
+                current.insert(entry.id, chunk);
+            }
+            ItemClipboard::putHeader(headers[i], types, quint32(snapshot.size()), bounds);
+        }
+        chunks.swap(current);   // 已删除或已换出图元的缓存随之丢弃
 
-        if(item) {
-            BaseCustomItem* baseItem = dynamic_cast<BaseCustomItem*>(item);
+        QByteArray header;
+        ItemClipboard::put<quint32>(header, kMagic);
+        ItemClipboard::put<quint16>(header, kVersion);
+        ItemClipboard::put<quint16>(header, quint16(slides.size()));
 
-            // 转换成功
-            if (baseItem) {
-                auto strategy = MenuStrategyFactory::GetInstance().create(baseItem->objectType());
-                if (strategy) {
-                    CmdCtxPtr ctx = std::make_shared<CommandContext>();
-                    ctx->scene = this;
-                    ctx->extras["selection"] = QVariant::fromValue(QList<BaseCustomItem*>() << baseItem);
-                    QMenu* menu = strategy->createMenu(nullptr, ctx);
-                    menu->exec(event->screenPos());
-                    delete menu;
-                    return;  // 菜单弹出后返回，防止继续冒泡
-                }
+        QSaveFile file(path);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(header);
+            for (size_t i = 0; i < slides.size(); ++i) {
+                writeSlide(file, slides[i], headers[i]);
+            }
+            if (!file.commit()) {
+                qWarning() << "autosave failed:" << path << file.errorString();
             }
         }
+        busy = false;
+    }
 
-        auto defaultStrategy = MenuStrategyFactory::GetInstance().create("Background");
-        if (defaultStrategy) {
-            CmdCtxPtr ctx = std::make_shared<CommandContext>();
-            QMenu* menu = defaultStrategy->createMenu(nullptr, ctx);
-            menu->exec(event->screenPos());
-            delete menu;
+    void writeSlide(QSaveFile& file, const SlideDocument::SlideContent& slide, const QByteArray& header) {
+        QByteArray length;
+        if (!slide.resident) {
+            ItemClipboard::put<quint32>(length, quint32(slide.payload.size()));
+            file.write(length);
+            file.write(slide.payload);
             return;
         }
 
-        QGraphicsScene::contextMenuEvent(event);
+        qint64 size = header.size();
+        for (const ItemSnapshot& entry : slide.snapshot) size += chunks.value(entry.id).bytes.size();
+        ItemClipboard::put<quint32>(length, quint32(size));
+        file.write(length);
+        file.write(header);
+        for (const ItemSnapshot& entry : slide.snapshot) {
+            file.write(chunks.value(entry.id).bytes);
+        }
     }
 
-private:
-    std::shared_ptr<MenuStrategy> menuStrategy;
+    // 类型表只追加，已缓存记录中的类型索引始终有效
+    quint16 typeIndexOf(const QString& type) {
+        auto it = typeIndex.constFind(type);
+        if (it != typeIndex.constEnd()) return it.value();
+        quint16 index = quint16(types.size());
+        types << type;
+        typeIndex.insert(type, index);
+        return index;
+    }
+
+    QPointer<SlideDocument> document;
+    QString path;
+    QTimer timer;
+    std::thread worker;
+    std::atomic<bool> busy{false};
+
+    QHash<quint64, Chunk> chunks;
+    quint64 encodedGeneration = 0;
+    QStringList types;
+    QHash<QString, quint16> typeIndex;
 };
 
 //*******************************************************************************************/
 //注册
 //*******************************************************************************************/
+// 注册各种图元
+void registerItemTypes() {
+    ItemFactory::GetInstance().registerCreator("TextItem", []() -> BaseCustomItem* { return new CustomItem(); });
+    ItemFactory::GetInstance().registerCreator("Special", []() -> BaseCustomItem* { return new CustomItem2(); });
+    ItemFactory::GetInstance().registerCreator("Circle", []() -> BaseCustomItem* { return new CustomItem3(); });
+    ItemFactory::GetInstance().registerCreator("Group", []() -> BaseCustomItem* { return new GroupItem(); });
+
+    // 类型层次与类别：新增子类型只需声明父类型即可沿用父类型菜单，无需为每个类型注册策略
+    // 声明与类继承一致：CustomItem3（Circle）派生自 CustomItem（TextItem）
+    MenuStrategyFactory::GetInstance().declareTypes({
+        { "TextItem", QString(), "Text" },
+        { "Special", QString(), "Shape" },
+        { "Circle", "TextItem", "Shape" },
+    });
+
+    ItemFactory::GetInstance().registerPainter("TextItem", &CustomItem::drawShape);
+    ItemFactory::GetInstance().registerPainter("Special", &CustomItem2::drawShape);
+    ItemFactory::GetInstance().registerPainter("Circle", &CustomItem3::drawShape);
+}
+
+// 注册各种命令，ID 供声明式菜单定义引用
+void registerCommands() {
+    CommandRegistry::GetInstance().registerCreator("null", []() { return std::make_shared<NullCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("copy", []() { return std::make_shared<CopyCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("cut", []() { return std::make_shared<CutCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("duplicate", []() { return std::make_shared<DuplicateCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("paste", []() { return std::make_shared<PasteCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("custom1", []() { return std::make_shared<CustomCommand1>(); });
+    CommandRegistry::GetInstance().registerCreator("custom2", []() { return std::make_shared<CustomCommand2>(); });
+    CommandRegistry::GetInstance().registerCreator("exportImage", []() { return std::make_shared<ExportImageCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("resizeAll", []() { return std::make_shared<ResizeAllCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("editText", []() { return std::make_shared<EditTextCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("group", []() { return std::make_shared<GroupCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("ungroup", []() { return std::make_shared<UngroupCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("bringToFront", []() { return std::make_shared<ZOrderCommand>(ZOrderCommand::BringToFront); });
+    CommandRegistry::GetInstance().registerCreator("sendToBack", []() { return std::make_shared<ZOrderCommand>(ZOrderCommand::SendToBack); });
+    CommandRegistry::GetInstance().registerCreator("moveUp", []() { return std::make_shared<ZOrderCommand>(ZOrderCommand::MoveUp); });
+    CommandRegistry::GetInstance().registerCreator("moveDown", []() { return std::make_shared<ZOrderCommand>(ZOrderCommand::MoveDown); });
+    CommandRegistry::GetInstance().registerCreator("layoutGrid", []() { return std::make_shared<LayoutCommand>(LayoutState::Grid); });
+    CommandRegistry::GetInstance().registerCreator("layoutFlow", []() { return std::make_shared<LayoutCommand>(LayoutState::Flow); });
+    CommandRegistry::GetInstance().registerCreator("layoutAlign", []() { return std::make_shared<LayoutCommand>(LayoutState::Align); });
+    CommandRegistry::GetInstance().registerCreator("addSlide", []() { return std::make_shared<AddSlideCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("changeFont", []() { return std::make_shared<ChangeFontCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("recolor", []() { return std::make_shared<RecolorSelectionCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("recolorType", []() { return std::make_shared<RecolorTypeCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("rotate", []() { return std::make_shared<RotateSelectionCommand>(); });
+    CommandRegistry::GetInstance().registerCreator("scale", []() { return std::make_shared<ScaleSelectionCommand>(); });
+}
+
 // 注册各种策略
 void registerMenuStrategies() {
     MenuStrategyFactory::GetInstance().registerCreator("TextItem", []() {
@@ -431,24 +5971,51 @@ void registerMenuStrategies() {
     MenuStrategyFactory::GetInstance().registerCreator("Background", []() {
         return std::make_shared<PasteOnlyMenuDecorator>(std::make_shared<BackgroundMenuStrategy>());
     });
-    MenuStrategyFactory::GetInstance().registerCreator("Special", []() {
-        // 不装饰基础菜单，只有特殊菜单
-        return std::make_shared<NoBaseMenuStrategy>();
-    });
     MenuStrategyFactory::GetInstance().registerCreator("Circle", []() {
         return std::make_shared<BaseMenuDecorator>(std::make_shared<CircleMenuStrategy>());
     });
+    MenuStrategyFactory::GetInstance().registerCreator("Group", []() {
+        return std::make_shared<BaseMenuDecorator>(std::make_shared<GroupMenuStrategy>());
+    });
 }
 
 
 Q_DECLARE_METATYPE(QList<BaseCustomItem*>)
+// 测试程序直接包含本文件，定义 CONTEXT_MENU_NO_MAIN 以使用自己的 main
+#ifndef CONTEXT_MENU_NO_MAIN
 int main(int argc, char *argv[]) {
     qRegisterMetaType<QList<BaseCustomItem*>>("QList<BaseCustomItem*>");
 
     QApplication app(argc, argv);
 
+    registerItemTypes();
+    registerCommands();
     registerMenuStrategies();
 
+    // 菜单图标，后台解析
+    IconRegistry::GetInstance().registerDirectory(QCoreApplication::applicationDirPath() + "/icons");
+    IconRegistry::GetInstance().preload();
+
+    // 插件策略按清单懒加载
+    PluginStrategyLoader plugins;
+    QString manifestPath = QString::fromLocal8Bit(qgetenv("CONTEXT_MENU_PLUGINS"));
+    if (manifestPath.isEmpty()) {
+        manifestPath = QCoreApplication::applicationDirPath() + "/plugins/index.json";
+    }
+    if (QFile::exists(manifestPath)) {
+        plugins.load(manifestPath);
+    }
+
+    // 声明式菜单定义覆盖同名的内置策略，文件修改后自动热重载
+    MenuDefinitionLoader menuDefinitions;
+    QString definitionPath = QString::fromLocal8Bit(qgetenv("CONTEXT_MENU_DEFINITIONS"));
+    if (definitionPath.isEmpty()) {
+        definitionPath = QCoreApplication::applicationDirPath() + "/menus.json";
+    }
+    if (QFile::exists(definitionPath)) {
+        menuDefinitions.load(definitionPath);
+    }
+
     // 创建场景
     CustomScene* scene = new CustomScene();
     // 添加带基础菜单的元素
@@ -467,7 +6034,66 @@ int main(int argc, char *argv[]) {
 
     QGraphicsView* view = new QGraphicsView(scene);
     view->setSceneRect(0, 0, 400, 300);
+    view->setDragMode(QGraphicsView::RubberBandDrag);
     view->show();
 
+    // 多页文档，PageUp/PageDown 翻页
+    SlideDocument document(scene);
+    document.setSceneChangedCallback([view](CustomScene* slide, int index, int count) {
+        view->setScene(slide);
+        view->setWindowTitle(QString("幻灯片 %1/%2").arg(index + 1).arg(count));
+    });
+    QObject::connect(new QShortcut(QKeySequence(Qt::Key_PageUp), view), &QShortcut::activated,
+                     [&document]() { document.show(document.currentIndex() - 1); });
+    QObject::connect(new QShortcut(QKeySequence(Qt::Key_PageDown), view), &QShortcut::activated,
+                     [&document]() { document.show(document.currentIndex() + 1); });
+
+    // 命令通知显示在视图底部
+    NotificationToast toast(view);
+    NotificationCenter::GetInstance().setSink([&toast](const QStringList& messages) { toast.show(messages); });
+
+    // 命令行传入场景文件时流式加载
+    StreamingSceneLoader loader(scene);
+    if (app.arguments().size() > 1) {
+        const QString title = view->windowTitle();
+        loader.setProgressCallback([view](qint64 done, qint64 total) {
+            int percent = total > 0 ? int(done * 100 / total) : 0;
+            view->setWindowTitle(QString("加载中 %1%").arg(percent));
+        });
+        // 加载期间固定目标页，翻页时不被换出
+        document.setPinned(scene, true);
+        loader.setFinishedCallback([view, title, &document, scene](bool cancelled) {
+            document.setPinned(scene, false);
+            view->setWindowTitle(cancelled ? QString("加载已取消") : title);
+        });
+        if (!loader.start(app.arguments().at(1))) document.setPinned(scene, false);
+    }
+
+    // 后台自动保存
+    QString autosavePath = QString::fromLocal8Bit(qgetenv("CONTEXT_MENU_AUTOSAVE"));
+    if (autosavePath.isEmpty()) {
+        autosavePath = QDir::temp().filePath("context_menu_demo.autosave");
+    }
+    AutosaveService autosave(&document, autosavePath);
+
+    // 长任务进度显示在标题栏
+    const QString baseTitle = view->windowTitle();
+    CooperativeScheduler::GetInstance().setProgressCallback([view, baseTitle](const QString& name, int percent) {
+        view->setWindowTitle(percent < 100 ? QString("%1 %2%").arg(name).arg(percent) : baseTitle);
+    });
+
+    // Esc 取消加载与调度中的长任务
+    QObject::connect(new QShortcut(QKeySequence(Qt::Key_Escape), view), &QShortcut::activated, [&loader]() {
+        loader.cancel();
+        CooperativeScheduler::GetInstance().cancelAll();
+    });
+
+    // 撤销/重做：当前页面与文档两个撤销栈中最近的一步
+    QObject::connect(new QShortcut(QKeySequence::Undo, view), &QShortcut::activated,
+                     [view, &document]() { OrderedUndoStack::stepLatest({ undoStackFor(view->scene()), undoStackFor(&document) }, false); });
+    QObject::connect(new QShortcut(QKeySequence::Redo, view), &QShortcut::activated,
+                     [view, &document]() { OrderedUndoStack::stepLatest({ undoStackFor(view->scene()), undoStackFor(&document) }, true); });
+
     return app.exec();
 }
+#endif
@@ -0,0 +1,124 @@
+#ifndef MENU_STRATEGY_PLUGIN_H
+#define MENU_STRATEGY_PLUGIN_H
+
+// 菜单策略插件的公开接口：命令上下文、命令、菜单策略、宿主服务与插件接口
+// 宿主程序与策略插件都包含本文件；插件不链接宿主程序的符号，只经 MenuHost 使用宿主的功能
+
+#include <QMenu>
+#include <QString>
+#include <QVariantMap>
+#include <QtPlugin>
+#include <QDebug>
+#include <memory>
+#include <coroutine>
+#include <exception>
+
+class QGraphicsScene;
+class QGraphicsItem;
+
+//*******************************************************************************************/
+//万能类型上下文
+//*******************************************************************************************/
+class CommandContext {
+public:
+    void* target = nullptr;                         // 可是任何图元、界面对象
+    QVariantMap extras;                             // 存储任意键值扩展
+    QGraphicsScene* scene = nullptr;                // 可选：传场景
+    QWidget* view = nullptr;                        // 可选：传视图
+    QGraphicsItem* item = nullptr;                  // 可选：传图元
+};
+
+using CmdCtxPtr = std::shared_ptr<CommandContext>;
+
+//*******************************************************************************************/
+// 协程
+//*******************************************************************************************/
+// 协程命令的返回类型：立即开始执行，不等待结果，协程帧在结束时自行释放
+class CommandTask {
+public:
+    struct promise_type {
+        CommandTask get_return_object() { return CommandTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {
+            try {
+                std::rethrow_exception(std::current_exception());
+            } catch (const std::exception& e) {
+                qWarning() << "command coroutine failed:" << e.what();
+            } catch (...) {
+                qWarning() << "command coroutine failed";
+            }
+        }
+    };
+};
+
+//*******************************************************************************************/
+// 右键命令
+//*******************************************************************************************/
+// 命令接口
+class ICommand : public std::enable_shared_from_this<ICommand> {
+public:
+    virtual ~ICommand() = default;
+    virtual void execute(CmdCtxPtr ctx) = 0;
+
+    // 菜单触发时调用的协程版本，可 co_await 后台任务、帧让出与剪贴板读取；默认同步执行 execute
+    // 重写时先持有 shared_from_this()，菜单销毁后命令对象仍需存活到协程结束
+    virtual CommandTask executeAsync(CmdCtxPtr ctx) {
+        execute(ctx);
+        co_return;
+    }
+
+    // 控制对应的Action是否启用
+    virtual bool isEnable(CmdCtxPtr ctx) const {
+        return true;
+    }
+
+    // 控制对应的Action是否显示
+    virtual bool isVisible(CmdCtxPtr ctx) const {
+        return true;
+    }
+
+    // 命令ID，用于查找图标等资源
+    virtual QString commandId() const {
+        return QString();
+    }
+};
+
+//*******************************************************************************************/
+// 菜单策略
+//*******************************************************************************************/
+// 策略接口
+class MenuStrategy {
+public:
+    virtual ~MenuStrategy() = default;
+    virtual QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) = 0;
+};
+
+// 宿主提供给插件的服务，生命周期与宿主程序相同
+class MenuHost {
+public:
+    virtual ~MenuHost() = default;
+
+    // 与内置策略相同的方式添加命令项：图标、启用状态，触发时记入最近命令
+    virtual void addCommandAction(QMenu* menu, const QString& text, std::shared_ptr<ICommand> cmd, CmdCtxPtr ctx) = 0;
+
+    // 按命令ID创建宿主的命令，未注册时返回空
+    virtual std::shared_ptr<ICommand> createCommand(const QString& id) = 0;
+};
+
+//*******************************************************************************************/
+// 策略插件
+//*******************************************************************************************/
+// 策略插件接口，插件导出实现该接口的根对象（Q_PLUGIN_METADATA + Q_INTERFACES）
+// 宿主在对应类型第一次查找策略时才加载插件
+class MenuStrategyPlugin {
+public:
+    virtual ~MenuStrategyPlugin() = default;
+    virtual std::shared_ptr<MenuStrategy> createStrategy(const QString& type, MenuHost* host) = 0;
+};
+
+#define MenuStrategyPlugin_iid "org.contextmenu.MenuStrategyPlugin/2.0"
+Q_DECLARE_INTERFACE(MenuStrategyPlugin, MenuStrategyPlugin_iid)
+
+#endif // MENU_STRATEGY_PLUGIN_H
@@ -0,0 +1,24 @@
+# "Special" 类型的菜单策略插件，由程序按 plugins/index.json 在第一次弹出该类型菜单时加载
+TEMPLATE = lib
+CONFIG += plugin c++2a
+
+QT       += widgets
+
+TARGET = specialmenu
+
+INCLUDEPATH += ../..
+
+HEADERS += \
+    ../../menu_strategy_plugin.h \
+    special_menu_plugin.h
+
+SOURCES += \
+    special_menu_plugin.cpp
+
+DISTFILES += \
+    special_menu_plugin.json
+
+# 清单复制到程序目录下的 plugins（本工程输出在其子目录 special）
+manifest.files = ../index.json
+manifest.path = $$OUT_PWD/..
+COPIES += manifest
@@ -0,0 +1,49 @@
+#include "special_menu_plugin.h"
+
+#include <vector>
+
+namespace {
+
+// 依次执行多个宿主命令
+class SequenceCommand : public ICommand {
+public:
+    void add(std::shared_ptr<ICommand> cmd) {
+        if (cmd) commands.push_back(std::move(cmd));
+    }
+
+    void execute(CmdCtxPtr ctx) override {
+        for (auto& cmd : commands) {
+            cmd->execute(ctx);
+        }
+    }
+
+private:
+    std::vector<std::shared_ptr<ICommand>> commands;
+};
+
+// 不支持基础菜单，只显示自己的菜单
+class NoBaseMenuStrategy : public MenuStrategy {
+public:
+    explicit NoBaseMenuStrategy(MenuHost* host) : host(host) {}
+
+    QMenu* createMenu(QWidget* parent, CmdCtxPtr ctx) override {
+        QMenu* menu = new QMenu(parent);
+
+        auto combo = std::make_shared<SequenceCommand>();
+        combo->add(host->createCommand("custom1"));
+        combo->add(host->createCommand("custom2"));
+
+        host->addCommandAction(menu, "无公共操作，仅特殊操作", combo, ctx);
+        return menu;
+    }
+
+private:
+    MenuHost* host;
+};
+
+}
+
+std::shared_ptr<MenuStrategy> SpecialMenuPlugin::createStrategy(const QString& type, MenuHost* host) {
+    if (type != "Special") return nullptr;
+    return std::make_shared<NoBaseMenuStrategy>(host);
+}
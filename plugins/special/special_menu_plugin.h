@@ -0,0 +1,17 @@
+#ifndef SPECIAL_MENU_PLUGIN_H
+#define SPECIAL_MENU_PLUGIN_H
+
+#include <QObject>
+#include "menu_strategy_plugin.h"
+
+// "Special" 类型的菜单策略插件：不装饰基础菜单，只有特殊操作
+class SpecialMenuPlugin : public QObject, public MenuStrategyPlugin {
+    Q_OBJECT
+    Q_PLUGIN_METADATA(IID MenuStrategyPlugin_iid FILE "special_menu_plugin.json")
+    Q_INTERFACES(MenuStrategyPlugin)
+
+public:
+    std::shared_ptr<MenuStrategy> createStrategy(const QString& type, MenuHost* host) override;
+};
+
+#endif // SPECIAL_MENU_PLUGIN_H
@@ -0,0 +1,15 @@
+# MenuStrategyFactory 并发压力测试，使用 ThreadSanitizer 构建
+# 由顶层工程构建，在顶层 make check 运行；也可在本目录单独 qmake && make check
+QT       += core gui concurrent svg
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG += c++2a console testcase sanitizer sanitize_thread
+CONFIG -= app_bundle
+
+TARGET = tst_registry_stress
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    tst_registry_stress.cpp
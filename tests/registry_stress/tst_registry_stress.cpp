@@ -0,0 +1,89 @@
+// MenuStrategyFactory 并发压力测试：32 个读线程持续查找菜单策略，写线程同时注册、替换创建函数和声明类型
+// 读到空策略或策略来自未知来源、结束后旧快照未回收即失败；数据竞争由 ThreadSanitizer 报告
+// 查找路径是否无锁无法由本测试检查
+#define CONTEXT_MENU_NO_MAIN
+#include "main.cpp"
+
+namespace {
+
+class ProbeStrategy : public MenuStrategy {
+public:
+    explicit ProbeStrategy(int source) : source(source) {}
+
+    QMenu* createMenu(QWidget*, CmdCtxPtr) override {
+        return nullptr;
+    }
+
+    const int source;
+};
+
+MenuStrategyFactory::Creator probe(int source) {
+    return [source]() -> std::shared_ptr<MenuStrategy> { return std::make_shared<ProbeStrategy>(source); };
+}
+
+const int kReaders = 32;
+const int kWrites = 2000;
+
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    MenuStrategyFactory& factory = MenuStrategyFactory::GetInstance();
+    factory.registerCreator("Background", probe(0));
+
+    const QStringList types = { "TextItem", "Circle", "Special", "Derived", "Unknown" };
+    std::atomic<bool> done{false};
+    std::atomic<int> failures{0};
+    std::atomic<qint64> lookups{0};
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < kReaders; ++r) {
+        readers.emplace_back([&, r]() {
+            qint64 count = 0;
+            for (int i = r; !done.load(std::memory_order_relaxed); ++i) {
+                std::shared_ptr<MenuStrategy> strategy = factory.create(types[i % types.size()]);
+                auto probed = std::dynamic_pointer_cast<ProbeStrategy>(strategy);
+                if (!probed || probed->source < 0 || probed->source > 3) failures.fetch_add(1);
+                ++count;
+            }
+            lookups.fetch_add(count);
+        });
+    }
+
+    for (int i = 0; i < kWrites; ++i) {
+        switch (i % 4) {
+        case 0:
+            factory.registerCreator("TextItem", probe(1));
+            break;
+        case 1:
+            factory.replaceCreators("stress.json", { qMakePair(QString("Circle"), probe(2)), qMakePair(QString("Shape"), probe(2)) });
+            break;
+        case 2:
+            factory.replaceCreators("stress.json", {});
+            break;
+        default:
+            factory.declareTypes({
+                { "Derived", i % 8 == 3 ? QString("TextItem") : QString("Circle"), QString() },
+                { "Special", QString(), "Shape" },
+            });
+            break;
+        }
+    }
+
+    done.store(true);
+    for (std::thread& reader : readers) reader.join();
+
+    // 读者都已退出，下一次发布应回收全部旧快照
+    factory.registerCreator("TextItem", probe(1));
+    if (factory.retiredSnapshots() != 0) {
+        qCritical() << "registry stress:" << factory.retiredSnapshots() << "snapshots not reclaimed";
+        return 1;
+    }
+
+    if (failures.load() != 0) {
+        qCritical() << "registry stress:" << failures.load() << "bad lookups of" << lookups.load();
+        return 1;
+    }
+    qInfo() << "registry stress:" << lookups.load() << "lookups," << kWrites << "writes, no failures";
+    return 0;
+}